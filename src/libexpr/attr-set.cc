@@ -14,7 +14,7 @@ Bindings * EvalState::allocBindings(size_t capacity)
 {
     if (capacity > std::numeric_limits<Bindings::size_t>::max())
         throw Error("attribute set of size %d is too big", capacity);
-    return new (allocBytes(sizeof(Bindings) + sizeof(Attr) * capacity)) Bindings((Bindings::size_t) capacity);
+    return new (allocBytes(Bindings::allocSize(capacity))) Bindings((Bindings::size_t) capacity);
 }
 
 
@@ -51,8 +51,40 @@ Value * EvalState::allocAttr(Value & vAttrs, const std::string & name)
 
 void Bindings::sort()
 {
+    dropIndex();
     std::sort(begin(), end());
 }
 
 
+bool Bindings::countLookups = false;
+unsigned long Bindings::nrIndexes = 0;
+unsigned long Bindings::nrIndexedLookups = 0;
+unsigned long Bindings::nrIndexedMisses = 0;
+unsigned long Bindings::nrBinaryLookups = 0;
+
+
+/* Build a hash index for this set with a load factor of at most 1/2,
+   using linear probing. Attributes are inserted in order, so if there
+   are duplicate names a lookup returns the first one, just like the
+   binary search. */
+void Bindings::buildIndex()
+{
+    uint32_t bits = 1;
+    while ((1UL << bits) < 2 * (unsigned long) size_) bits++;
+    uint32_t mask = (1U << bits) - 1;
+
+    auto index = (uint32_t *) allocBytes(((size_t) mask + 2) * sizeof(uint32_t));
+    index[0] = bits;
+
+    for (size_t n = 0; n < size_; n++) {
+        uint32_t h = hashSymbol(attrs[n].name, bits);
+        while (index[h + 1]) h = (h + 1) & mask;
+        index[h + 1] = n + 1;
+    }
+
+    indexState().index = index;
+    nrIndexes++;
+}
+
+
 }
@@ -30,19 +30,102 @@ struct Attr
 /* Bindings contains all the attributes of an attribute set. It is defined
    by its size and its capacity, the capacity being the number of Attr
    elements allocated after this structure, while the size corresponds to
-   the number of elements already inserted in this structure. */
+   the number of elements already inserted in this structure.
+
+   Attributes are kept sorted by symbol, so lookups are normally a
+   binary search. Large sets that are looked up repeatedly (such as
+   the top-level Nixpkgs set) additionally get a lazily built
+   open-addressing hash index mapping symbols to attribute
+   positions. The index is dropped whenever the set is modified. Only
+   sets with a capacity of at least 'indexThreshold' have room for
+   the index, which is stored after the attributes, so small sets pay
+   nothing for it. */
 class Bindings
 {
 public:
     typedef uint32_t size_t;
 
+    /* Sets smaller than this are never indexed. */
+    static constexpr size_t indexThreshold = 32;
+
+    /* Number of binary searches on a large set before we build an
+       index for it. This avoids indexing sets that are only looked up
+       once or twice (e.g. the result of a '//'). */
+    static constexpr uint32_t indexAfterLookups = 8;
+
+    /* Statistics, reported by EvalState::printStats(). The lookup
+       counters are only maintained if 'countLookups' is set. */
+    static bool countLookups;
+    static unsigned long nrIndexes;
+    static unsigned long nrIndexedLookups;
+    static unsigned long nrIndexedMisses;
+    static unsigned long nrBinaryLookups;
+
 private:
     size_t size_, capacity_;
     Attr attrs[0];
 
-    Bindings(size_t capacity) : size_(0), capacity_(capacity) { }
+    /* The index of a large set. 'index[0]' is the log2 of the number
+       of slots; slot 'i' is stored in 'index[i + 1]' and contains the
+       position of an attribute plus one, or 0 if it's empty. */
+    struct IndexState
+    {
+        uint32_t * index = nullptr;
+        uint32_t lookups = 0;
+    };
+
+    static bool indexable(size_t capacity)
+    {
+        return capacity >= indexThreshold;
+    }
+
+    /* Number of bytes needed for a set with the given capacity. */
+    static std::size_t allocSize(std::size_t capacity)
+    {
+        return sizeof(Bindings) + sizeof(Attr) * capacity
+            + (indexable(capacity) ? sizeof(IndexState) : 0);
+    }
+
+    IndexState & indexState()
+    {
+        return *(IndexState *) &attrs[capacity_];
+    }
+
+    Bindings(size_t capacity) : size_(0), capacity_(capacity)
+    {
+        if (indexable(capacity_)) new (&indexState()) IndexState;
+    }
+
     Bindings(const Bindings & bindings) = delete;
 
+    static uint32_t hashSymbol(const Symbol & name, uint32_t bits)
+    {
+        return (uint32_t) ((name.hash() * 0x9e3779b97f4a7c15ULL) >> (64 - bits));
+    }
+
+    void buildIndex();
+
+    Attr * getIndexed(const uint32_t * index, const Symbol & name)
+    {
+        if (countLookups) nrIndexedLookups++;
+        uint32_t bits = index[0], mask = (1U << bits) - 1;
+        for (uint32_t h = hashSymbol(name, bits); ; h = (h + 1) & mask) {
+            auto n = index[h + 1];
+            if (!n) break;
+            if (attrs[n - 1].name == name) return &attrs[n - 1];
+        }
+        if (countLookups) nrIndexedMisses++;
+        return nullptr;
+    }
+
+    void dropIndex()
+    {
+        if (!indexable(capacity_)) return;
+        auto & st(indexState());
+        st.index = nullptr;
+        st.lookups = 0;
+    }
+
 public:
     size_t size() const { return size_; }
 
@@ -53,19 +136,25 @@ public:
     void push_back(const Attr & attr)
     {
         assert(size_ < capacity_);
+        dropIndex();
         attrs[size_++] = attr;
     }
 
     iterator find(const Symbol & name)
     {
-        Attr key(name, 0);
-        iterator i = std::lower_bound(begin(), end(), key);
-        if (i != end() && i->name == name) return i;
-        return end();
+        auto a = get(name);
+        return a ? a : end();
     }
 
     Attr * get(const Symbol & name)
     {
+        if (size_ >= indexThreshold) {
+            auto & st(indexState());
+            if (!st.index && ++st.lookups >= indexAfterLookups)
+                buildIndex();
+            if (st.index) return getIndexed(st.index, name);
+        }
+        if (countLookups) nrBinaryLookups++;
         Attr key(name, 0);
         iterator i = std::lower_bound(begin(), end(), key);
         if (i != end() && i->name == name) return &*i;
@@ -3,6 +3,9 @@
 #include "eval.hh"
 #include "eval-inline.hh"
 #include "store-api.hh"
+#include "derivations.hh"
+#include "fs-accessor.hh"
+#include "compression.hh"
 
 namespace nix::eval_cache {
 
@@ -15,6 +18,11 @@ create table if not exists Attributes (
     context     text,
     primary key (parent, name)
 );
+
+create table if not exists Derivations (
+    path        text primary key not null,
+    contents    text not null
+);
 )sql";
 
 struct AttrDb
@@ -28,6 +36,9 @@ struct AttrDb
         SQLiteStmt insertAttributeWithContext;
         SQLiteStmt queryAttribute;
         SQLiteStmt queryAttributes;
+        SQLiteStmt queryChildren;
+        SQLiteStmt insertDerivation;
+        SQLiteStmt queryDerivation;
         std::unique_ptr<SQLiteTxn> txn;
     };
 
@@ -59,6 +70,15 @@ struct AttrDb
         state->queryAttributes.create(state->db,
             "select name from Attributes where parent = ?");
 
+        state->queryChildren.create(state->db,
+            "select rowid, type, value, context, name from Attributes where parent = ?");
+
+        state->insertDerivation.create(state->db,
+            "insert or replace into Derivations(path, contents) values (?, ?)");
+
+        state->queryDerivation.create(state->db,
+            "select contents from Derivations where path = ?");
+
         state->txn = std::make_unique<SQLiteTxn>(state->db);
     }
 
@@ -230,6 +250,30 @@ struct AttrDb
         });
     }
 
+    void setDerivation(std::string_view path, std::string_view contents)
+    {
+        doSQLite([&]()
+        {
+            auto state(_state->lock());
+
+            state->insertDerivation.use()
+                (path)
+                (contents).exec();
+
+            return 0;
+        });
+    }
+
+    std::optional<std::string> getDerivation(std::string_view path)
+    {
+        auto state(_state->lock());
+
+        auto queryDerivation(state->queryDerivation.use()(path));
+        if (!queryDerivation.next()) return {};
+
+        return queryDerivation.getStr(0);
+    }
+
     std::optional<std::pair<AttrId, AttrValue>> getAttr(
         AttrKey key,
         SymbolTable & symbols)
@@ -242,32 +286,64 @@ struct AttrDb
         auto rowId = (AttrType) queryAttribute.getInt(0);
         auto type = (AttrType) queryAttribute.getInt(1);
 
+        if (type == AttrType::FullAttrs) {
+            // FIXME: expensive, should separate this out.
+            std::vector<Symbol> attrs;
+            auto queryAttributes(state->queryAttributes.use()(rowId));
+            while (queryAttributes.next())
+                attrs.push_back(symbols.create(queryAttributes.getStr(0)));
+            return {{rowId, attrs}};
+        }
+
+        return {{rowId, decodeValue(queryAttribute, type)}};
+    }
+
+    /* Return the cached values of all children of 'parent' using a
+       single query, rather than one query per child. Children that
+       are attribute sets are omitted, since fetching their
+       attribute names would require a query for each of them. */
+    std::map<Symbol, std::pair<AttrId, AttrValue>> getChildren(
+        AttrId parent,
+        SymbolTable & symbols)
+    {
+        auto state(_state->lock());
+
+        std::map<Symbol, std::pair<AttrId, AttrValue>> children;
+
+        auto queryChildren(state->queryChildren.use()(parent));
+        while (queryChildren.next()) {
+            auto type = (AttrType) queryChildren.getInt(1);
+            if (type == AttrType::FullAttrs) continue;
+            children.emplace(
+                symbols.create(queryChildren.getStr(4)),
+                std::make_pair((AttrId) queryChildren.getInt(0), decodeValue(queryChildren, type)));
+        }
+
+        return children;
+    }
+
+    /* Decode a value other than an attribute set from a row with
+       columns (rowid, type, value, context). */
+    static AttrValue decodeValue(SQLiteStmt::Use & query, AttrType type)
+    {
         switch (type) {
             case AttrType::Placeholder:
-                return {{rowId, placeholder_t()}};
-            case AttrType::FullAttrs: {
-                // FIXME: expensive, should separate this out.
-                std::vector<Symbol> attrs;
-                auto queryAttributes(state->queryAttributes.use()(rowId));
-                while (queryAttributes.next())
-                    attrs.push_back(symbols.create(queryAttributes.getStr(0)));
-                return {{rowId, attrs}};
-            }
+                return placeholder_t();
             case AttrType::String: {
                 std::vector<std::pair<Path, std::string>> context;
-                if (!queryAttribute.isNull(3))
-                    for (auto & s : tokenizeString<std::vector<std::string>>(queryAttribute.getStr(3), ";"))
+                if (!query.isNull(3))
+                    for (auto & s : tokenizeString<std::vector<std::string>>(query.getStr(3), ";"))
                         context.push_back(decodeContext(s));
-                return {{rowId, string_t{queryAttribute.getStr(2), context}}};
+                return string_t{query.getStr(2), context};
             }
             case AttrType::Bool:
-                return {{rowId, queryAttribute.getInt(2) != 0}};
+                return query.getInt(2) != 0;
             case AttrType::Missing:
-                return {{rowId, missing_t()}};
+                return missing_t();
             case AttrType::Misc:
-                return {{rowId, misc_t()}};
+                return misc_t();
             case AttrType::Failed:
-                return {{rowId, failed_t()}};
+                return failed_t();
             default:
                 throw Error("unexpected type in evaluation cache");
         }
@@ -385,27 +461,63 @@ Value & AttrCursor::forceValue()
     } catch (EvalError &) {
         debug("setting '%s' to failed", getAttrPathStr());
         if (root->db)
-            cachedValue = {root->db->setFailed(getKey()), failed_t()};
+            setCachedValue({root->db->setFailed(getKey()), failed_t()});
         throw;
     }
 
     if (root->db && (!cachedValue || std::get_if<placeholder_t>(&cachedValue->second))) {
         if (v.type == tString)
-            cachedValue = {root->db->setString(getKey(), v.string.s, v.string.context),
-                           string_t{v.string.s, {}}};
+            setCachedValue({root->db->setString(getKey(), v.string.s, v.string.context),
+                            string_t{v.string.s, {}}});
         else if (v.type == tPath)
-            cachedValue = {root->db->setString(getKey(), v.path), v.path};
+            setCachedValue({root->db->setString(getKey(), v.path), v.path});
         else if (v.type == tBool)
-            cachedValue = {root->db->setBool(getKey(), v.boolean), v.boolean};
+            setCachedValue({root->db->setBool(getKey(), v.boolean), v.boolean});
         else if (v.type == tAttrs)
             ; // FIXME: do something?
         else
-            cachedValue = {root->db->setMisc(getKey()), misc_t()};
+            setCachedValue({root->db->setMisc(getKey()), misc_t()});
     }
 
     return v;
 }
 
+static const size_t maxPrefetchedChildren = 128;
+static const unsigned int prefetchAfterLookups = 4;
+
+void AttrCursor::setCachedValue(std::pair<AttrId, AttrValue> && v)
+{
+    cachedValue = std::move(v);
+    if (parent && parent->first->cachedChildren)
+        parent->first->cachedChildren->erase(parent->second);
+}
+
+std::optional<std::pair<AttrId, AttrValue>> AttrCursor::getCachedChild(Symbol name)
+{
+    assert(root->db && cachedValue);
+
+    /* Fetching all children costs a row per child, so only do it
+       for attribute sets that are known to be small (like most
+       derivations), or once the caller has looked up several
+       children of a set of unknown size. Large sets such as
+       'legacyPackages.<system>' are usually only looked up once. */
+    if (!cachedChildren) {
+        auto attrs = std::get_if<std::vector<Symbol>>(&cachedValue->second);
+        if (attrs
+            ? attrs->size() <= maxPrefetchedChildren
+            : ++childLookups > prefetchAfterLookups)
+            cachedChildren = root->db->getChildren(cachedValue->first, root->state.symbols);
+    }
+
+    if (cachedChildren) {
+        auto i = cachedChildren->find(name);
+        if (i != cachedChildren->end())
+            return i->second;
+    }
+
+    return root->db->getAttr({cachedValue->first, name}, root->state.symbols);
+}
+
 std::shared_ptr<AttrCursor> AttrCursor::maybeGetAttr(Symbol name, bool forceErrors)
 {
     if (root->db) {
@@ -416,10 +528,11 @@ std::shared_ptr<AttrCursor> AttrCursor::maybeGetAttr(Symbol name, bool forceErro
             if (auto attrs = std::get_if<std::vector<Symbol>>(&cachedValue->second)) {
                 for (auto & attr : *attrs)
                     if (attr == name)
-                        return std::make_shared<AttrCursor>(root, std::make_pair(shared_from_this(), name));
+                        return std::make_shared<AttrCursor>(root,
+                            std::make_pair(shared_from_this(), name), nullptr, getCachedChild(name));
                 return nullptr;
             } else if (std::get_if<placeholder_t>(&cachedValue->second)) {
-                auto attr = root->db->getAttr({cachedValue->first, name}, root->state.symbols);
+                auto attr = getCachedChild(name);
                 if (attr) {
                     if (std::get_if<missing_t>(&attr->second))
                         return nullptr;
@@ -451,8 +564,9 @@ std::shared_ptr<AttrCursor> AttrCursor::maybeGetAttr(Symbol name, bool forceErro
     if (!attr) {
         if (root->db) {
             if (!cachedValue)
-                cachedValue = {root->db->setPlaceholder(getKey()), placeholder_t()};
+                setCachedValue({root->db->setPlaceholder(getKey()), placeholder_t()});
             root->db->setMissing({cachedValue->first, name});
+            if (cachedChildren) cachedChildren->erase(name);
         }
         return nullptr;
     }
@@ -460,8 +574,9 @@ std::shared_ptr<AttrCursor> AttrCursor::maybeGetAttr(Symbol name, bool forceErro
     std::optional<std::pair<AttrId, AttrValue>> cachedValue2;
     if (root->db) {
         if (!cachedValue)
-            cachedValue = {root->db->setPlaceholder(getKey()), placeholder_t()};
+            setCachedValue({root->db->setPlaceholder(getKey()), placeholder_t()});
         cachedValue2 = {root->db->setPlaceholder({cachedValue->first, name}), placeholder_t()};
+        if (cachedChildren) cachedChildren->erase(name);
     }
 
     return std::make_shared<AttrCursor>(
@@ -600,7 +715,7 @@ std::vector<Symbol> AttrCursor::getAttrs()
     });
 
     if (root->db)
-        cachedValue = {root->db->setAttrs(getKey(), attrs), attrs};
+        setCachedValue({root->db->setAttrs(getKey(), attrs), attrs});
 
     return attrs;
 }
@@ -611,18 +726,75 @@ bool AttrCursor::isDerivation()
     return aType && aType->getString() == "derivation";
 }
 
+/* Keep a copy of a store derivation so that it can be restored
+   without evaluation if it is garbage-collected. It is stored
+   xz-compressed and base64-encoded to keep the database small. */
+static void saveDerivation(AttrDb & db, Store & store, const StorePath & drvPath)
+{
+    auto drvPathS = store.printStorePath(drvPath);
+    try {
+        auto contents = store.getFSAccessor()->readFile(drvPathS);
+        db.setDerivation(drvPathS, base64Encode(*compress("xz", contents)));
+    } catch (Error & e) {
+        debug("cannot save derivation '%s' in the evaluation cache: %s", drvPathS, e.msg());
+    }
+}
+
+/* Try to recreate a garbage-collected store derivation from the copy
+   in the evaluation cache. This requires its inputs to be valid. */
+static bool restoreDerivation(AttrDb & db, Store & store, const StorePath & drvPath)
+{
+    auto contents = db.getDerivation(store.printStorePath(drvPath));
+    if (!contents) return false;
+
+    try {
+        auto drv = parseDerivation(store,
+            std::move(*decompress("xz", base64Decode(*contents))),
+            Derivation::nameFromPath(drvPath));
+
+        for (auto & i : drv.inputSrcs)
+            if (!store.isValidPath(i)) return false;
+        for (auto & i : drv.inputDrvs)
+            if (!store.isValidPath(i.first)) return false;
+
+        if (writeDerivation(store, drv) != drvPath) return false;
+    } catch (Error & e) {
+        debug("cannot restore derivation '%s' from the evaluation cache: %s",
+            store.printStorePath(drvPath), e.msg());
+        return false;
+    }
+
+    debug("restored derivation '%s' from the evaluation cache", store.printStorePath(drvPath));
+    return true;
+}
+
 StorePath AttrCursor::forceDerivation()
 {
+    auto & store = *root->state.store;
     auto aDrvPath = getAttr(root->state.sDrvPath, true);
-    auto drvPath = root->state.store->parseStorePath(aDrvPath->getString());
-    if (!root->state.store->isValidPath(drvPath) && !settings.readOnlyMode) {
+    auto drvPath = store.parseStorePath(aDrvPath->getString());
+
+    /* If 'drvPath' was evaluated rather than taken from the cache,
+       the derivation has just been written, so save a copy of it. */
+    if (aDrvPath->_value) {
+        if (root->db && store.isValidPath(drvPath))
+            saveDerivation(*root->db, store, drvPath);
+    }
+
+    else if (!store.isValidPath(drvPath) && !settings.readOnlyMode) {
         /* The eval cache contains 'drvPath', but the actual path has
-           been garbage-collected. So force it to be regenerated. */
-        aDrvPath->forceValue();
-        if (!root->state.store->isValidPath(drvPath))
-            throw Error("don't know how to recreate store derivation '%s'!",
-                root->state.store->printStorePath(drvPath));
+           been garbage-collected. Restore it from the cached copy if
+           possible, and otherwise force it to be regenerated. */
+        if (!root->db || !restoreDerivation(*root->db, store, drvPath)) {
+            aDrvPath->forceValue();
+            if (!store.isValidPath(drvPath))
+                throw Error("don't know how to recreate store derivation '%s'!",
+                    store.printStorePath(drvPath));
+            if (root->db)
+                saveDerivation(*root->db, store, drvPath);
+        }
     }
+
     return drvPath;
 }
 
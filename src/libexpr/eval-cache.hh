@@ -74,8 +74,23 @@ class AttrCursor : public std::enable_shared_from_this<AttrCursor>
     RootValue _value;
     std::optional<std::pair<AttrId, AttrValue>> cachedValue;
 
+    /* The cached values of the children of this attribute, fetched
+       in a single query once several children are likely to be
+       looked up (see getCachedChild()). */
+    std::optional<std::map<Symbol, std::pair<AttrId, AttrValue>>> cachedChildren;
+
+    /* The number of children looked up one by one. */
+    unsigned int childLookups = 0;
+
     AttrKey getKey();
 
+    std::optional<std::pair<AttrId, AttrValue>> getCachedChild(Symbol name);
+
+    /* Set the cached value of this attribute after writing it to
+       the database, dropping the stale copy prefetched by the
+       parent. */
+    void setCachedValue(std::pair<AttrId, AttrValue> && v);
+
     Value & getValue();
 
 public:
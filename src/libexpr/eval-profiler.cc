@@ -0,0 +1,101 @@
+#include "eval-profiler.hh"
+#include "eval.hh"
+#include "util.hh"
+
+#include <fstream>
+
+namespace nix {
+
+EvalProfiler::EvalProfiler(const unsigned long & nrValues)
+    : nrValues(nrValues)
+{ }
+
+
+EvalProfiler::Node & EvalProfiler::enter(const void * key)
+{
+    auto & parent = stack.empty() ? root : *stack.back().node;
+    auto & child = parent.children[key];
+    if (!child) child = std::make_unique<Node>();
+    stack.push_back(Frame {
+        .node = child.get(),
+        .start = std::chrono::steady_clock::now(),
+        .valuesStart = nrValues,
+    });
+    return *child;
+}
+
+
+/* Semicolons separate frames in the collapsed stack format. */
+static std::string makeLabel(const std::string & s)
+{
+    return replaceStrings(s, ";", ",");
+}
+
+
+void EvalProfiler::enter(const ExprLambda & lambda)
+{
+    auto & node = enter(&lambda);
+    if (node.label.empty())
+        node.label = makeLabel(fmt("%s at %s",
+            lambda.name.set() ? (string) lambda.name : "anonymous lambda",
+            lambda.pos));
+}
+
+
+void EvalProfiler::enter(const PrimOp & primOp)
+{
+    auto & node = enter(&primOp);
+    if (node.label.empty())
+        node.label = makeLabel(fmt("primop %s", primOp.name));
+}
+
+
+void EvalProfiler::leave()
+{
+    assert(!stack.empty());
+    auto frame = stack.back();
+    stack.pop_back();
+
+    uint64_t time = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - frame.start).count();
+    uint64_t values = nrValues - frame.valuesStart;
+
+    frame.node->time += time - std::min(time, frame.childTime);
+    frame.node->values += values - std::min(values, frame.childValues);
+
+    if (!stack.empty()) {
+        stack.back().childTime += time;
+        stack.back().childValues += values;
+    }
+}
+
+
+void EvalProfiler::write(const Path & path)
+{
+    std::ofstream timeFile(path), valuesFile(path + ".values");
+    if (!timeFile || !valuesFile)
+        throw SysError("opening profile file '%s'", path);
+
+    std::string prefix;
+
+    std::function<void(const Node &)> recurse;
+    recurse = [&](const Node & node) {
+        for (auto & i : node.children) {
+            auto & child = *i.second;
+            auto oldSize = prefix.size();
+            if (!prefix.empty()) prefix += ';';
+            prefix += child.label;
+            if (child.time) timeFile << prefix << " " << child.time << "\n";
+            if (child.values) valuesFile << prefix << " " << child.values << "\n";
+            recurse(child);
+            prefix.resize(oldSize);
+        }
+    };
+
+    recurse(root);
+
+    if (!timeFile || !valuesFile)
+        throw SysError("writing profile file '%s'", path);
+}
+
+}
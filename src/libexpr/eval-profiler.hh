@@ -0,0 +1,76 @@
+#pragma once
+
+#include "types.hh"
+
+#include <chrono>
+#include <unordered_map>
+
+namespace nix {
+
+struct ExprLambda;
+struct PrimOp;
+
+/* An aggregating profiler for the evaluator, enabled by the
+   'eval-profile-file' setting. It keeps a tree of Nix-level call
+   stacks (function and primop calls), recording for each stack the
+   time spent and the number of values allocated, excluding callees.
+   The result is written in the "collapsed stack" format used by
+   flamegraph.pl and speedscope. */
+class EvalProfiler
+{
+    struct Node
+    {
+        std::string label;
+        std::unordered_map<const void *, std::unique_ptr<Node>> children;
+        uint64_t time = 0; // in nanoseconds
+        uint64_t values = 0;
+    };
+
+    struct Frame
+    {
+        Node * node;
+        std::chrono::steady_clock::time_point start;
+        uint64_t childTime = 0;
+        uint64_t valuesStart;
+        uint64_t childValues = 0;
+    };
+
+    Node root;
+    std::vector<Frame> stack;
+
+    /* The evaluator's counter of allocated values. */
+    const unsigned long & nrValues;
+
+    Node & enter(const void * key);
+
+public:
+
+    EvalProfiler(const unsigned long & nrValues);
+
+    void enter(const ExprLambda & lambda);
+    void enter(const PrimOp & primOp);
+    void leave();
+
+    /* Write the time spent in each call stack to 'path', and the
+       number of values allocated to 'path.values'. */
+    void write(const Path & path);
+
+    /* Record a call for the lifetime of this object. */
+    struct Call
+    {
+        EvalProfiler & profiler;
+
+        template<typename T>
+        Call(EvalProfiler & profiler, const T & fun) : profiler(profiler)
+        {
+            profiler.enter(fun);
+        }
+
+        ~Call()
+        {
+            profiler.leave();
+        }
+    };
+};
+
+}
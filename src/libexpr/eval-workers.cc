@@ -0,0 +1,148 @@
+#include "eval-workers.hh"
+#include "serialise.hh"
+#include "util.hh"
+
+#include <poll.h>
+
+namespace nix {
+
+struct EvalWorker
+{
+    Pid pid;
+    AutoCloseFD toFd, fromFd;
+    FdSink to;
+    FdSource from;
+
+    /* The job currently being processed by this worker, if any. */
+    std::optional<std::string> job;
+};
+
+
+void runEvalWorkers(
+    size_t nrWorkers,
+    const Strings & jobs,
+    std::function<EvalWorkerFun()> init,
+    std::function<void(const std::string & job, const std::string & result)> onResult)
+{
+    nrWorkers = std::min(nrWorkers, jobs.size());
+
+    std::vector<std::unique_ptr<EvalWorker>> workers;
+
+    for (size_t n = 0; n < nrWorkers; ++n) {
+        Pipe toWorker, fromWorker;
+        toWorker.create();
+        fromWorker.create();
+
+        ProcessOptions options;
+        options.allowVfork = false;
+
+        auto worker = std::make_unique<EvalWorker>();
+
+        worker->pid = startProcess([&]() {
+            /* Don't keep the pipes to the other workers open. */
+            for (auto & w : workers) {
+                w->toFd = -1;
+                w->fromFd = -1;
+            }
+            toWorker.writeSide = -1;
+            fromWorker.readSide = -1;
+
+            FdSource from(toWorker.readSide.get());
+            FdSink to(fromWorker.writeSide.get());
+
+            auto fun = init();
+
+            while (true) {
+                std::string job;
+                try {
+                    job = readString(from);
+                } catch (EndOfFile &) {
+                    break;
+                }
+
+                try {
+                    auto result = fun(job);
+                    to << 1 << result;
+                } catch (Error & e) {
+                    to << 0 << e;
+                } catch (std::exception & e) {
+                    to << 0 << Error(e.what());
+                }
+                to.flush();
+            }
+
+            _exit(0);
+        }, options);
+
+        worker->toFd = std::move(toWorker.writeSide);
+        worker->fromFd = std::move(fromWorker.readSide);
+        worker->to = FdSink(worker->toFd.get());
+        worker->from = FdSource(worker->fromFd.get());
+
+        workers.push_back(std::move(worker));
+    }
+
+    auto nextJob = jobs.begin();
+    size_t active = 0;
+
+    auto startJob = [&](EvalWorker & worker) {
+        if (nextJob == jobs.end()) return;
+        worker.job = *nextJob++;
+        worker.to << *worker.job;
+        worker.to.flush();
+        active++;
+    };
+
+    for (auto & worker : workers)
+        startJob(*worker);
+
+    while (active) {
+        std::vector<struct pollfd> fds;
+        std::vector<EvalWorker *> busy;
+        for (auto & worker : workers)
+            if (worker->job) {
+                fds.push_back({ .fd = worker->fromFd.get(), .events = POLLIN, .revents = 0 });
+                busy.push_back(worker.get());
+            }
+
+        if (poll(fds.data(), fds.size(), -1) == -1) {
+            if (errno != EINTR)
+                throw SysError("waiting for evaluation workers");
+        }
+
+        checkInterrupt();
+
+        for (size_t n = 0; n < fds.size(); ++n) {
+            if (!fds[n].revents) continue;
+
+            auto & worker = *busy[n];
+            auto job = std::move(*worker.job);
+            worker.job.reset();
+            active--;
+
+            std::string result;
+            try {
+                if (!readNum<unsigned int>(worker.from))
+                    throw readError(worker.from);
+                result = readString(worker.from);
+            } catch (EndOfFile &) {
+                throw Error("evaluation worker died while processing '%s'", job);
+            }
+
+            onResult(job, result);
+
+            startJob(worker);
+        }
+    }
+
+    /* Closing the pipes tells the workers to exit. */
+    for (auto & worker : workers) {
+        worker->toFd = -1;
+        worker->fromFd = -1;
+    }
+
+    for (auto & worker : workers)
+        worker->pid.wait();
+}
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "types.hh"
+
+#include <functional>
+
+namespace nix {
+
+/* A function, run in a worker process, that processes one job and
+   returns its result. */
+typedef std::function<std::string(const std::string & job)> EvalWorkerFun;
+
+/* Process 'jobs' in parallel using up to 'nrWorkers' worker
+   processes. The evaluator is single-threaded, so rather than sharing
+   an EvalState between threads, each worker is a forked process that
+   calls 'init' to set up its own EvalState (typically evaluating the
+   same top-level expression as the parent) and returns the function
+   that processes jobs. Jobs are handed out one at a time to idle
+   workers. 'onResult' is called in the parent, in order of
+   completion, with the result of each job. If a job fails, its error
+   is rethrown in the parent. */
+void runEvalWorkers(
+    size_t nrWorkers,
+    const Strings & jobs,
+    std::function<EvalWorkerFun()> init,
+    std::function<void(const std::string & job, const std::string & result)> onResult);
+
+}
@@ -8,6 +8,7 @@
 #include "filetransfer.hh"
 #include "json.hh"
 #include "function-trace.hh"
+#include "eval-profiler.hh"
 
 #include <algorithm>
 #include <chrono>
@@ -394,6 +395,12 @@ EvalState::EvalState(const Strings & _searchPath, ref<Store> store)
 {
     countCalls = getEnv("NIX_COUNT_CALLS").value_or("0") != "0";
 
+    if (countCalls || getEnv("NIX_SHOW_STATS").value_or("0") != "0")
+        Bindings::countLookups = true;
+
+    if (evalSettings.evalProfileFile.get() != "")
+        profiler = std::make_unique<EvalProfiler>(nrValues);
+
     assert(gcInitialised);
 
     static_assert(sizeof(Env) <= 16, "environment must be <= 16 bytes");
@@ -436,12 +443,25 @@ EvalState::EvalState(const Strings & _searchPath, ref<Store> store)
     vEmptySet.type = tAttrs;
     vEmptySet.attrs = allocBindings(0);
 
+    mkNull(vNull);
+    mkBool(vTrue, true);
+    mkBool(vFalse, false);
+    for (NixInt n = 0; n < nrSmallInts; ++n)
+        mkInt(vSmallInts[n], n);
+
     createBaseEnv();
 }
 
 
 EvalState::~EvalState()
 {
+    if (profiler) {
+        try {
+            profiler->write(evalSettings.evalProfileFile);
+        } catch (...) {
+            ignoreException();
+        }
+    }
 }
 
 
@@ -737,12 +757,19 @@ void mkPath(Value & v, const char * s)
 }
 
 
+unsigned long nrWithLookups = 0;
+unsigned long nrWithLookupsCached = 0;
+
 inline Value * EvalState::lookupVar(Env * env, const ExprVar & var, bool noEval)
 {
     for (size_t l = var.level; l; --l, env = env->up) ;
 
     if (!var.fromWith) return env->values[var.displ];
 
+    nrWithLookups++;
+
+    bool innermost = true;
+
     while (1) {
         if (env->type == Env::HasWithExpr) {
             if (noEval) return 0;
@@ -751,11 +778,32 @@ inline Value * EvalState::lookupVar(Env * env, const ExprVar & var, bool noEval)
             env->values[0] = v;
             env->type = Env::HasWithAttrs;
         }
-        Bindings::iterator j = env->values[0]->attrs->find(var.name);
-        if (j != env->values[0]->attrs->end()) {
+        Bindings * attrs = env->values[0]->attrs;
+
+        /* The cached position is validated against the name, so a
+           stale entry (e.g. for a set that has since been freed and
+           reallocated) is harmless. */
+        if (innermost
+            && var.cachedAttrs == attrs
+            && var.cachedPos < attrs->size()
+            && (*attrs)[var.cachedPos].name == var.name)
+        {
+            nrWithLookupsCached++;
+            auto & attr = (*attrs)[var.cachedPos];
+            if (countCalls && attr.pos) attrSelects[*attr.pos]++;
+            return attr.value;
+        }
+
+        Bindings::iterator j = attrs->find(var.name);
+        if (j != attrs->end()) {
             if (countCalls && j->pos) attrSelects[*j->pos]++;
+            if (innermost) {
+                var.cachedAttrs = attrs;
+                var.cachedPos = j - attrs->begin();
+            }
             return j->value;
         }
+        innermost = false;
         if (!env->prevWith)
             throwUndefinedVarError(var.pos, "undefined variable '%1%'", var.name);
         for (size_t l = env->prevWith; l; --l, env = env->up) ;
@@ -779,6 +827,32 @@ Value * EvalState::allocValue()
 }
 
 
+Value * EvalState::allocNull()
+{
+    nrValuesShared++;
+    return &vNull;
+}
+
+
+Value * EvalState::allocBool(bool b)
+{
+    nrValuesShared++;
+    return b ? &vTrue : &vFalse;
+}
+
+
+Value * EvalState::allocInt(NixInt n)
+{
+    if (n >= 0 && n < nrSmallInts) {
+        nrValuesShared++;
+        return &vSmallInts[n];
+    }
+    auto v = allocValue();
+    mkInt(*v, n);
+    return v;
+}
+
+
 Env & EvalState::allocEnv(size_t size)
 {
     nrEnvs++;
@@ -800,6 +874,8 @@ void EvalState::mkList(Value & v, size_t size)
     else if (size == 2)
         v.type = tList2;
     else {
+        if (size > std::numeric_limits<uint32_t>::max())
+            throw EvalError("list of %d elements is too large", size);
         v.type = tListN;
         v.bigList.size = size;
         v.bigList.elems = size ? (Value * *) allocBytes(size * sizeof(Value *)) : 0;
@@ -808,6 +884,26 @@ void EvalState::mkList(Value & v, size_t size)
 }
 
 
+void EvalState::mkListSlice(Value & v, Value & list, size_t start, size_t size)
+{
+    assert(&v != &list);
+    assert(start + size <= list.listSize());
+
+    if (size <= 2 || list.type != tListN) {
+        mkList(v, size);
+        for (size_t n = 0; n < size; ++n)
+            v.listElems()[n] = list.listElems()[start + n];
+        return;
+    }
+
+    nrListSlices++;
+    v.type = tListN;
+    v.bigList.elems = list.bigList.elems;
+    v.bigList.offset = list.bigList.offset + start;
+    v.bigList.size = size;
+}
+
+
 unsigned long nrThunks = 0;
 
 static inline void mkThunk(Value & v, Env & env, Expr * expr)
@@ -830,8 +926,8 @@ void EvalState::mkPos(Value & v, Pos * pos)
     if (pos && pos->file.set()) {
         mkAttrs(v, 3);
         mkString(*allocAttr(v, sFile), pos->file);
-        mkInt(*allocAttr(v, sLine), pos->line);
-        mkInt(*allocAttr(v, sColumn), pos->column);
+        v.attrs->push_back(Attr(sLine, allocInt(pos->line)));
+        v.attrs->push_back(Attr(sColumn, allocInt(pos->column)));
         v.attrs->sort();
     } else
         mkNull(v);
@@ -886,6 +982,39 @@ Value * ExprPath::maybeThunk(EvalState & state, Env & env)
     return &v;
 }
 
+/* Evaluating a function just captures its environment, which is what
+   a thunk would do, so skip the thunk. */
+Value * ExprLambda::maybeThunk(EvalState & state, Env & env)
+{
+    nrAvoided++;
+    Value * v = state.allocValue();
+    eval(state, env, *v);
+    return v;
+}
+
+Value * ExprAttrs::maybeThunk(EvalState & state, Env & env)
+{
+    if (!recursive && attrs.empty() && dynamicAttrs.empty()) {
+        nrAvoided++;
+        return &state.vEmptySet;
+    }
+    return Expr::maybeThunk(state, env);
+}
+
+
+std::optional<EvalState::FileStatus> EvalState::getFileStatus(const Path & path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == -1) return std::nullopt;
+#if __APPLE__
+    auto & mtim(st.st_mtimespec), & ctim(st.st_ctimespec);
+#else
+    auto & mtim(st.st_mtim), & ctim(st.st_ctim);
+#endif
+    return FileStatus(st.st_dev, st.st_ino, st.st_size,
+        mtim.tv_sec, mtim.tv_nsec, ctim.tv_sec, ctim.tv_nsec);
+}
+
 
 void EvalState::evalFile(const Path & path_, Value & v, bool mustBeTrivial)
 {
@@ -910,8 +1039,14 @@ void EvalState::evalFile(const Path & path_, Value & v, bool mustBeTrivial)
     if (j != fileParseCache.end())
         e = j->second;
 
-    if (!e)
+    if (!e) {
+        /* Stat the file before reading it, so that a modification
+           racing with the parse invalidates the parse tree. */
+        auto st = getFileStatus(path2);
         e = parseExprFromFile(checkSourcePath(path2));
+        if (st)
+            fileParseStatus[path2] = *st;
+    }
 
     fileParseCache[path2] = e;
 
@@ -935,7 +1070,18 @@ void EvalState::evalFile(const Path & path_, Value & v, bool mustBeTrivial)
 void EvalState::resetFileCache()
 {
     fileEvalCache.clear();
-    fileParseCache.clear();
+
+    /* Evaluation results may depend on any file, but a parse tree
+       only depends on its own file. */
+    for (auto i = fileParseCache.begin(); i != fileParseCache.end(); ) {
+        auto j = fileParseStatus.find(i->first);
+        if (j != fileParseStatus.end() && getFileStatus(i->first) == j->second)
+            ++i;
+        else {
+            fileParseStatus.erase(i->first);
+            i = fileParseCache.erase(i);
+        }
+    }
 }
 
 
@@ -1250,7 +1396,14 @@ void EvalState::callPrimOp(Value & fun, Value & arg, Value & v, const Pos & pos)
         /* And call the primop. */
         nrPrimOpCalls++;
         if (countCalls) primOpCalls[primOp->primOp->name]++;
-        primOp->primOp->fun(*this, pos, vArgs, v);
+        /* This is conditional on the profiler, because the
+           profiler's call guard has a destructor that makes this
+           function not tail-recursive. */
+        if (profiler) {
+            EvalProfiler::Call profilerCall(*profiler, *primOp->primOp);
+            primOp->primOp->fun(*this, pos, vArgs, v);
+        } else
+            primOp->primOp->fun(*this, pos, vArgs, v);
     } else {
         Value * fun2 = allocValue();
         *fun2 = fun;
@@ -1340,24 +1493,38 @@ void EvalState::callFunction(Value & fun, Value & arg, Value & v, const Pos & po
     nrFunctionCalls++;
     if (countCalls) incrFunctionCall(&lambda);
 
-    /* Evaluate the body.  This is conditional on showTrace, because
-       catching exceptions makes this function not tail-recursive. */
-    if (loggerSettings.showTrace.get())
-        try {
+    /* Evaluate the body.  This is conditional on the profiler and
+       on showTrace, because the profiler's call guard and catching
+       exceptions make this function not tail-recursive. */
+    if (profiler) {
+        EvalProfiler::Call profilerCall(*profiler, lambda);
+        if (loggerSettings.showTrace.get())
+            evalLambdaBodyWithTrace(lambda, env2, v, pos);
+        else
             lambda.body->eval(*this, env2, v);
-        } catch (Error & e) {
-            addErrorTrace(e, lambda.pos, "while evaluating %s",
-              (lambda.name.set()
-                  ? "'" + (string) lambda.name + "'"
-                  : "anonymous lambda"));
-            addErrorTrace(e, pos, "from call site%s", "");
-            throw;
-        }
+    }
+    else if (loggerSettings.showTrace.get())
+        evalLambdaBodyWithTrace(lambda, env2, v, pos);
     else
         fun.lambda.fun->body->eval(*this, env2, v);
 }
 
 
+void EvalState::evalLambdaBodyWithTrace(ExprLambda & lambda, Env & env, Value & v, const Pos & pos)
+{
+    try {
+        lambda.body->eval(*this, env, v);
+    } catch (Error & e) {
+        addErrorTrace(e, lambda.pos, "while evaluating %s",
+          (lambda.name.set()
+              ? "'" + (string) lambda.name + "'"
+              : "anonymous lambda"));
+        addErrorTrace(e, pos, "from call site%s", "");
+        throw;
+    }
+}
+
+
 // Lifted out of callFunction() because it creates a temporary that
 // prevents tail-call optimisation.
 void EvalState::incrFunctionCall(ExprLambda * fun)
@@ -1558,8 +1725,7 @@ void EvalState::concatLists(Value & v, size_t nrLists, Value * * lists, const Po
 
 void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
 {
-    PathSet context;
-    std::ostringstream s;
+    StringConcat s;
     NixInt n = 0;
     NixFloat nf = 0;
 
@@ -1597,7 +1763,7 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
             } else
                 throwEvalError(pos, "cannot add %1% to a float", showType(vTmp));
         } else
-            s << state.coerceToString(pos, vTmp, context, false, firstType == tString);
+            s.add(state, pos, vTmp, false, firstType == tString);
     }
 
     if (firstType == tInt)
@@ -1605,12 +1771,12 @@ void ExprConcatStrings::eval(EvalState & state, Env & env, Value & v)
     else if (firstType == tFloat)
         mkFloat(v, nf);
     else if (firstType == tPath) {
-        if (!context.empty())
+        if (s.hasContext())
             throwEvalError(pos, "a string that refers to a store path cannot be appended to a path");
-        auto path = canonPath(s.str());
+        auto path = canonPath(s.s);
         mkPath(v, path.c_str());
     } else
-        mkString(v, s.str(), context);
+        s.mkString(v);
 }
 
 
@@ -1727,6 +1893,52 @@ void copyContext(const Value & v, PathSet & context)
 }
 
 
+void StringConcat::add(EvalState & state, const Pos & pos, Value & v,
+    bool coerceMore, bool copyToStore)
+{
+    state.forceValue(v, pos);
+
+    if (v.type == tString) {
+        s.append(v.string.s);
+        addContext(v.string.context);
+        return;
+    }
+
+    unshareContext();
+    s.append(state.coerceToString(pos, v, context, coerceMore, copyToStore));
+}
+
+
+void StringConcat::addContext(const char * * c)
+{
+    if (!c || !*c || c == sharedContext) return;
+    if (!sharedContext && context.empty()) {
+        sharedContext = c;
+        return;
+    }
+    unshareContext();
+    for (; *c; ++c)
+        context.insert(*c);
+}
+
+
+void StringConcat::unshareContext()
+{
+    if (!sharedContext) return;
+    for (const char * * p = sharedContext; *p; ++p)
+        context.insert(*p);
+    sharedContext = nullptr;
+}
+
+
+void StringConcat::mkString(Value & v)
+{
+    nix::mkString(v, s, context);
+    if (sharedContext)
+        v.string.context = sharedContext;
+}
+
+
 std::vector<std::pair<Path, std::string>> Value::getContext()
 {
     std::vector<std::pair<Path, std::string>> res;
@@ -1992,11 +2204,13 @@ void EvalState::printStats()
             lists.attr("elements", nrListElems);
             lists.attr("bytes", bLists);
             lists.attr("concats", nrListConcats);
+            lists.attr("slices", nrListSlices);
         }
         {
             auto values = topObj.object("values");
             values.attr("number", nrValues);
             values.attr("bytes", bValues);
+            values.attr("shared", nrValuesShared);
         }
         {
             auto syms = topObj.object("symbols");
@@ -2008,6 +2222,10 @@ void EvalState::printStats()
             sets.attr("number", nrAttrsets);
             sets.attr("bytes", bAttrsets);
             sets.attr("elements", nrAttrsInAttrsets);
+            sets.attr("indexed", Bindings::nrIndexes);
+            sets.attr("indexedLookups", Bindings::nrIndexedLookups);
+            sets.attr("indexedMisses", Bindings::nrIndexedMisses);
+            sets.attr("binaryLookups", Bindings::nrBinaryLookups);
         }
         {
             auto sizes = topObj.object("sizes");
@@ -2021,6 +2239,8 @@ void EvalState::printStats()
         topObj.attr("nrThunks", nrThunks);
         topObj.attr("nrAvoided", nrAvoided);
         topObj.attr("nrLookups", nrLookups);
+        topObj.attr("nrWithLookups", nrWithLookups);
+        topObj.attr("nrWithLookupsCached", nrWithLookupsCached);
         topObj.attr("nrPrimOpCalls", nrPrimOpCalls);
         topObj.attr("nrFunctionCalls", nrFunctionCalls);
 #if HAVE_BOEHMGC
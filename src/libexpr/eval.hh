@@ -17,6 +17,7 @@ namespace nix {
 
 class Store;
 class EvalState;
+class EvalProfiler;
 class StorePath;
 enum RepairFlag : bool;
 
@@ -48,6 +49,34 @@ Value & mkString(Value & v, std::string_view s, const PathSet & context = PathSe
 void copyContext(const Value & v, PathSet & context);
 
 
+/* Accumulates the result of concatenating strings. Strings are
+   appended without intermediate copies. If all string context comes
+   from a single context array, that array is shared with the result
+   rather than copied element by element into a new one. */
+struct StringConcat
+{
+    string s;
+    PathSet context;
+    const char * * sharedContext = nullptr;
+
+    /* Append 'v', coercing it to a string if necessary. */
+    void add(EvalState & state, const Pos & pos, Value & v,
+        bool coerceMore = false, bool copyToStore = true);
+
+    bool hasContext() const
+    {
+        return sharedContext || !context.empty();
+    }
+
+    /* Store the result as a string value in 'v'. */
+    void mkString(Value & v);
+
+private:
+    void addContext(const char * * c);
+    void unshareContext();
+};
+
+
 /* Cache for calls to addToStore(); maps source paths to the store
    paths. */
 typedef std::map<Path, StorePath> SrcToStore;
@@ -94,6 +123,15 @@ public:
 
     Value vEmptySet;
 
+    /* Preallocated values for 'null', the Booleans and small
+       integers. Such values are never modified after construction, so
+       they can be shared by every Value pointer that needs one
+       (similar to the values stored in ExprInt etc.). Use
+       allocNull(), allocBool() and allocInt() to get them. */
+    Value vNull, vTrue, vFalse;
+    static constexpr NixInt nrSmallInts = 256;
+    Value vSmallInts[nrSmallInts];
+
     const ref<Store> store;
 
 
@@ -108,6 +146,13 @@ private:
 #endif
     FileParseCache fileParseCache;
 
+    /* The device, inode, size, and modification and change times
+       (in nanoseconds) of the files in fileParseCache, taken just
+       before they were parsed. */
+    typedef std::tuple<uint64_t, uint64_t, uint64_t, int64_t, int64_t, int64_t, int64_t> FileStatus;
+    std::map<Path, FileStatus> fileParseStatus;
+    static std::optional<FileStatus> getFileStatus(const Path & path);
+
     /* A cache from path names to values. */
 #if HAVE_BOEHMGC
     typedef std::map<Path, Value, std::less<Path>, traceable_allocator<std::pair<const Path, Value> > > FileEvalCache;
@@ -123,9 +168,12 @@ private:
     /* Cache used by checkSourcePath(). */
     std::unordered_map<Path, Path> resolvedPaths;
 
-    /* Cache used by prim_match(). */
+    /* Cache used by prim_match() and prim_split(). */
     std::shared_ptr<RegexCache> regexCache;
 
+    /* Profiler enabled by the 'eval-profile-file' setting. */
+    std::unique_ptr<EvalProfiler> profiler;
+
 public:
 
     EvalState(const Strings & _searchPath, ref<Store> store);
@@ -163,6 +211,9 @@ public:
        trivial (i.e. doesn't require arbitrary computation). */
     void evalFile(const Path & path, Value & v, bool mustBeTrivial = false);
 
+    /* Forget the results of evaluating files, e.g. after they have
+       been edited. The parse trees of files that haven't changed are
+       kept. */
     void resetFileCache();
 
     /* Look up a file in the search path. */
@@ -285,12 +336,27 @@ public:
     void callFunction(Value & fun, Value & arg, Value & v, const Pos & pos);
     void callPrimOp(Value & fun, Value & arg, Value & v, const Pos & pos);
 
+private:
+
+    /* Evaluate the body of a lambda, adding the call to the trace of
+       any error it throws. */
+    void evalLambdaBodyWithTrace(ExprLambda & lambda, Env & env, Value & v, const Pos & pos);
+
+public:
+
     /* Automatically call a function for which each argument has a
        default value or has a binding in the `args' map. */
     void autoCallFunction(Bindings & args, Value & fun, Value & res);
 
     /* Allocation primitives. */
     Value * allocValue();
+
+    /* Return a value containing 'null', a Boolean or an integer.
+       These may return a shared value, so the caller must not modify
+       the result. */
+    Value * allocNull();
+    Value * allocBool(bool b);
+    Value * allocInt(NixInt n);
     Env & allocEnv(size_t size);
 
     Value * allocAttr(Value & vAttrs, const Symbol & name);
@@ -299,6 +365,11 @@ public:
     Bindings * allocBindings(size_t capacity);
 
     void mkList(Value & v, size_t length);
+
+    /* Make 'v' a list containing elements 'start' to 'start + length
+       - 1' of 'list', sharing the elements of 'list' where
+       possible. 'v' must not be 'list'. */
+    void mkListSlice(Value & v, Value & list, size_t start, size_t length);
     void mkAttrs(Value & v, size_t capacity);
     void mkThunk_(Value & v, Expr * expr);
     void mkPos(Value & v, Pos * pos);
@@ -315,12 +386,14 @@ private:
     unsigned long nrEnvs = 0;
     unsigned long nrValuesInEnvs = 0;
     unsigned long nrValues = 0;
+    unsigned long nrValuesShared = 0;
     unsigned long nrListElems = 0;
     unsigned long nrAttrsets = 0;
     unsigned long nrAttrsInAttrsets = 0;
     unsigned long nrOpUpdates = 0;
     unsigned long nrOpUpdateValuesCopied = 0;
     unsigned long nrListConcats = 0;
+    unsigned long nrListSlices = 0;
     unsigned long nrPrimOpCalls = 0;
     unsigned long nrFunctionCalls = 0;
 
@@ -342,6 +415,7 @@ private:
     friend struct ExprSelect;
     friend void prim_getAttr(EvalState & state, const Pos & pos, Value * * args, Value & v);
     friend void prim_match(EvalState & state, const Pos & pos, Value * * args, Value & v);
+    friend void prim_split(EvalState & state, const Pos & pos, Value * * args, Value & v);
 };
 
 
@@ -428,6 +502,33 @@ struct EvalSettings : Config
 
     Setting<bool> useEvalCache{this, true, "eval-cache",
         "Whether to use the flake evaluation cache."};
+
+    Setting<unsigned int> evalWorkers{this, 1, "eval-workers",
+        R"(
+          The number of worker processes used by operations that can
+          evaluate independent parts of an expression in parallel, such as
+          `nix-env -qa --json`. Each worker has its own evaluator, so
+          memory usage grows with the number of workers. The default, `1`,
+          evaluates everything in the calling process.
+        )"};
+
+    Setting<Path> evalProfileFile{this, "", "eval-profile-file",
+        R"(
+          If set, the Nix evaluator will profile function and primop calls,
+          and write the time spent in each Nix call stack to the specified
+          file when evaluation finishes, in the collapsed stack format
+          accepted by `flamegraph.pl` and speedscope. The number of values
+          allocated by each call stack is written to the same file with
+          `.values` appended.
+        )"};
+
+    Setting<bool> useParseCache{this, false, "parse-cache",
+        R"(
+          If set to `true`, the Nix evaluator will keep the parse trees of
+          Nix files in `~/.cache/nix/parse-cache`, so that files that have
+          not changed since they were last evaluated don't need to be
+          parsed again.
+        )"};
 };
 
 extern EvalSettings evalSettings;
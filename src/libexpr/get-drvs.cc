@@ -320,6 +320,48 @@ static string addToPath(const string & s1, const string & s2)
 static std::regex attrRegex("[A-Za-z_][A-Za-z0-9-_+]*");
 
 
+static void getDerivations(EvalState & state, Value & vIn,
+    const string & pathPrefix, Bindings & autoArgs,
+    DrvInfos & drvs, Done & done,
+    bool ignoreAssertionFailures);
+
+
+/* Process the attribute 'attr' of a set being traversed by
+   getDerivations(). */
+static void getDerivationsInAttr(EvalState & state, const Attr & attr,
+    const string & pathPrefix, Bindings & autoArgs,
+    DrvInfos & drvs, Done & done,
+    bool ignoreAssertionFailures, bool combineChannels)
+{
+    string pathPrefix2 = addToPath(pathPrefix, attr.name);
+    if (combineChannels)
+        getDerivations(state, *attr.value, pathPrefix2, autoArgs, drvs, done, ignoreAssertionFailures);
+    else if (getDerivation(state, *attr.value, pathPrefix2, drvs, done, ignoreAssertionFailures)) {
+        /* If the value of this attribute is itself a set,
+           should we recurse into it?  => Only if it has a
+           `recurseForDerivations = true' attribute. */
+        if (attr.value->type == tAttrs) {
+            Bindings::iterator j = attr.value->attrs->find(state.sRecurseForDerivations);
+            if (j != attr.value->attrs->end() && state.forceBool(*j->value, *j->pos))
+                getDerivations(state, *attr.value, pathPrefix2, autoArgs, drvs, done, ignoreAssertionFailures);
+        }
+    }
+}
+
+
+/* Process the element 'n' of a list being traversed by
+   getDerivations(). */
+static void getDerivationsInElem(EvalState & state, Value & v, unsigned int n,
+    const string & pathPrefix, Bindings & autoArgs,
+    DrvInfos & drvs, Done & done,
+    bool ignoreAssertionFailures)
+{
+    string pathPrefix2 = addToPath(pathPrefix, (format("%1%") % n).str());
+    if (getDerivation(state, *v.listElems()[n], pathPrefix2, drvs, done, ignoreAssertionFailures))
+        getDerivations(state, *v.listElems()[n], pathPrefix2, autoArgs, drvs, done, ignoreAssertionFailures);
+}
+
+
 static void getDerivations(EvalState & state, Value & vIn,
     const string & pathPrefix, Bindings & autoArgs,
     DrvInfos & drvs, Done & done,
@@ -346,28 +388,14 @@ static void getDerivations(EvalState & state, Value & vIn,
             debug("evaluating attribute '%1%'", i->name);
             if (!std::regex_match(std::string(i->name), attrRegex))
                 continue;
-            string pathPrefix2 = addToPath(pathPrefix, i->name);
-            if (combineChannels)
-                getDerivations(state, *i->value, pathPrefix2, autoArgs, drvs, done, ignoreAssertionFailures);
-            else if (getDerivation(state, *i->value, pathPrefix2, drvs, done, ignoreAssertionFailures)) {
-                /* If the value of this attribute is itself a set,
-                   should we recurse into it?  => Only if it has a
-                   `recurseForDerivations = true' attribute. */
-                if (i->value->type == tAttrs) {
-                    Bindings::iterator j = i->value->attrs->find(state.sRecurseForDerivations);
-                    if (j != i->value->attrs->end() && state.forceBool(*j->value, *j->pos))
-                        getDerivations(state, *i->value, pathPrefix2, autoArgs, drvs, done, ignoreAssertionFailures);
-                }
-            }
+            getDerivationsInAttr(state, *i, pathPrefix, autoArgs, drvs, done,
+                ignoreAssertionFailures, combineChannels);
         }
     }
 
     else if (v.isList()) {
-        for (unsigned int n = 0; n < v.listSize(); ++n) {
-            string pathPrefix2 = addToPath(pathPrefix, (format("%1%") % n).str());
-            if (getDerivation(state, *v.listElems()[n], pathPrefix2, drvs, done, ignoreAssertionFailures))
-                getDerivations(state, *v.listElems()[n], pathPrefix2, autoArgs, drvs, done, ignoreAssertionFailures);
-        }
+        for (unsigned int n = 0; n < v.listSize(); ++n)
+            getDerivationsInElem(state, v, n, pathPrefix, autoArgs, drvs, done, ignoreAssertionFailures);
     }
 
     else throw TypeError("expression does not evaluate to a derivation (or a set or list of those)");
@@ -382,4 +410,51 @@ void getDerivations(EvalState & state, Value & v, const string & pathPrefix,
 }
 
 
+Strings getDerivationRoots(EvalState & state, Value & v)
+{
+    Strings roots;
+
+    if (state.isDerivation(v)) ;
+
+    else if (v.type == tAttrs) {
+        for (auto & i : v.attrs->lexicographicOrder())
+            if (std::regex_match(std::string(i->name), attrRegex))
+                roots.push_back(i->name);
+    }
+
+    else if (v.isList()) {
+        for (unsigned int n = 0; n < v.listSize(); ++n)
+            roots.push_back(std::to_string(n));
+    }
+
+    return roots;
+}
+
+
+void getDerivationsFromRoot(EvalState & state, Value & v, const string & root,
+    const string & pathPrefix, Bindings & autoArgs, DrvInfos & drvs,
+    bool ignoreAssertionFailures)
+{
+    Done done;
+
+    if (v.type == tAttrs) {
+        bool combineChannels = v.attrs->find(state.symbols.create("_combineChannels")) != v.attrs->end();
+        auto attr = v.attrs->get(state.symbols.create(root));
+        if (!attr)
+            throw Error("attribute '%s' missing", root);
+        getDerivationsInAttr(state, *attr, pathPrefix, autoArgs, drvs, done,
+            ignoreAssertionFailures, combineChannels);
+    }
+
+    else if (v.isList()) {
+        unsigned int n;
+        if (!string2Int(root, n) || n >= v.listSize())
+            throw Error("list element '%s' missing", root);
+        getDerivationsInElem(state, v, n, pathPrefix, autoArgs, drvs, done, ignoreAssertionFailures);
+    }
+
+    else throw TypeError("expression does not evaluate to a set or list of derivations");
+}
+
+
 }
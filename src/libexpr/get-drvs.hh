@@ -85,5 +85,17 @@ void getDerivations(EvalState & state, Value & v, const string & pathPrefix,
     Bindings & autoArgs, DrvInfos & drvs,
     bool ignoreAssertionFailures);
 
+/* Return the names of the top-level attributes (or the indices of the
+   list elements) of 'v' that getDerivations() would traverse, or an
+   empty list if 'v' is itself a derivation. 'v' must already have
+   been evaluated and auto-called. Each root can be processed
+   independently by getDerivationsFromRoot(), e.g. in separate
+   evaluation workers. */
+Strings getDerivationRoots(EvalState & state, Value & v);
+
+void getDerivationsFromRoot(EvalState & state, Value & v, const string & root,
+    const string & pathPrefix, Bindings & autoArgs, DrvInfos & drvs,
+    bool ignoreAssertionFailures);
+
 
 }
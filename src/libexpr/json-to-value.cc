@@ -1,5 +1,6 @@
 #include "json-to-value.hh"
 
+#include <numeric>
 #include <variant>
 #include <nlohmann/json.hpp>
 
@@ -28,26 +29,60 @@ class JSONSax : nlohmann::json_sax<json> {
                 v = allocRootValue(state.allocValue());
             return **v;
         }
+        /* Whether a shared value (see EvalState::allocNull() etc.)
+           can be used for a trivial result, i.e. unless we're
+           supposed to write the result into a value that already
+           exists. */
+        bool canShare() const
+        {
+            return !v;
+        }
+        void share(Value * shared)
+        {
+            v = allocRootValue(shared);
+        }
         virtual ~JSONState() {}
         virtual void add() {}
     };
 
     class JSONObjectState : public JSONState {
         using JSONState::JSONState;
-        ValueMap attrs;
+        /* The members in input order. They are sorted only once, when
+           the object is complete, rather than kept in a map. */
+        std::vector<Symbol> keys;
+        ValueVector values;
+        Symbol currentKey;
         std::unique_ptr<JSONState> resolve(EvalState & state) override
         {
+            std::vector<size_t> order(keys.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return keys[a] < keys[b];
+            });
+
+            /* In case of duplicate keys, the last occurrence wins. */
+            size_t size = 0;
+            for (size_t n = 0; n < order.size(); ++n)
+                if (n + 1 == order.size() || keys[order[n]] != keys[order[n + 1]])
+                    size++;
+
             Value & v = parent->value(state);
-            state.mkAttrs(v, attrs.size());
-            for (auto & i : attrs)
-                v.attrs->push_back(Attr(i.first, i.second));
+            state.mkAttrs(v, size);
+            for (size_t n = 0; n < order.size(); ++n)
+                if (n + 1 == order.size() || keys[order[n]] != keys[order[n + 1]])
+                    v.attrs->push_back(Attr(keys[order[n]], values[order[n]]));
             return std::move(parent);
         }
-        void add() override { v = nullptr; }
+        void add() override
+        {
+            keys.push_back(currentKey);
+            values.push_back(*v);
+            v = nullptr;
+        }
     public:
         void key(string_t & name, EvalState & state)
         {
-            attrs.insert_or_assign(state.symbols.create(name), &value(state));
+            currentKey = state.symbols.create(name);
         }
     };
 
@@ -86,23 +121,37 @@ class JSONSax : nlohmann::json_sax<json> {
 public:
     JSONSax(EvalState & state, Value & v) : state(state), rs(new JSONState(&v)) {};
 
+    /* Only call 'alloc' if the value can actually be shared, since
+       it counts the value as shared. */
+    template<typename F> inline bool handle_shared(F alloc)
+    {
+        if (!rs->canShare()) return false;
+        rs->share(alloc());
+        rs->add();
+        return true;
+    }
+
     bool null()
     {
-        return handle_value(mkNull);
+        return handle_shared([&]() { return state.allocNull(); }) || handle_value(mkNull);
     }
 
     bool boolean(bool val)
     {
-        return handle_value(mkBool, val);
+        return handle_shared([&]() { return state.allocBool(val); }) || handle_value(mkBool, val);
     }
 
     bool number_integer(number_integer_t val)
     {
+        if (val >= 0 && val < EvalState::nrSmallInts && handle_shared([&]() { return state.allocInt(val); }))
+            return true;
         return handle_value(mkInt, val);
     }
 
     bool number_unsigned(number_unsigned_t val)
     {
+        if (val < (number_unsigned_t) EvalState::nrSmallInts && handle_shared([&]() { return state.allocInt(val); }))
+            return true;
         return handle_value(mkInt, val);
     }
 
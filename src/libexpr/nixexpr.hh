@@ -152,6 +152,14 @@ struct ExprVar : Expr
     unsigned int level;
     unsigned int displ;
 
+    /* For variables that come from a "with", the attribute set in
+       which the variable was last found in the innermost "with", and
+       its position in that set. Since the same "with" expression
+       usually yields the same set (e.g. "with lib;"), this allows
+       most lookups to skip the search. */
+    mutable const Bindings * cachedAttrs = nullptr;
+    mutable unsigned int cachedPos = 0;
+
     ExprVar(const Symbol & name) : name(name) { };
     ExprVar(const Pos & pos, const Symbol & name) : pos(pos), name(name) { };
     COMMON_METHODS
@@ -200,6 +208,7 @@ struct ExprAttrs : Expr
     DynamicAttrDefs dynamicAttrs;
     ExprAttrs() : recursive(false) { };
     COMMON_METHODS
+    Value * maybeThunk(EvalState & state, Env & env);
 };
 
 struct ExprList : Expr
@@ -245,6 +254,7 @@ struct ExprLambda : Expr
     void setName(Symbol & name);
     string showNamePos() const;
     COMMON_METHODS
+    Value * maybeThunk(EvalState & state, Env & env);
 };
 
 struct ExprLet : Expr
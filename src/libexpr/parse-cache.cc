@@ -0,0 +1,505 @@
+#include "parse-cache.hh"
+#include "eval.hh"
+#include "globals.hh"
+#include "hash.hh"
+#include "serialise.hh"
+#include "util.hh"
+
+#include <cstring>
+
+namespace nix {
+
+/* Bump this whenever the AST or its serialisation changes. */
+static const unsigned int parseCacheVersion = 1;
+
+enum ExprTag : uint64_t {
+    tagNull = 0,
+    tagInt,
+    tagFloat,
+    tagString,
+    tagPath,
+    tagVar,
+    tagSelect,
+    tagOpHasAttr,
+    tagAttrs,
+    tagList,
+    tagLambda,
+    tagLet,
+    tagWith,
+    tagIf,
+    tagAssert,
+    tagOpNot,
+    tagApp,
+    tagOpEq,
+    tagOpNEq,
+    tagOpAnd,
+    tagOpOr,
+    tagOpImpl,
+    tagOpUpdate,
+    tagOpConcatLists,
+    tagConcatStrings,
+    tagPos,
+    tagEnd = 0xffff,
+};
+
+
+struct ParseCacheWriter
+{
+    StringSink sink;
+
+    /* Symbols are written only once; subsequent occurrences refer to
+       them by number. 0 denotes an unset symbol. */
+    std::map<Symbol, uint64_t> symbols;
+
+    void write(const Symbol & s)
+    {
+        if (!s.set()) {
+            sink << 0;
+            return;
+        }
+        auto i = symbols.find(s);
+        if (i != symbols.end()) {
+            sink << i->second;
+            return;
+        }
+        uint64_t n = symbols.size() + 1;
+        symbols.emplace(s, n);
+        sink << n << (const string &) s;
+    }
+
+    void write(const Pos & pos)
+    {
+        sink << pos.origin;
+        write(pos.file);
+        sink << pos.line << pos.column;
+    }
+
+    void write(const AttrPath & attrPath)
+    {
+        sink << attrPath.size();
+        for (auto & i : attrPath) {
+            if (i.symbol.set()) {
+                sink << 1;
+                write(i.symbol);
+            } else {
+                sink << 0;
+                write(i.expr);
+            }
+        }
+    }
+
+    template<class T>
+    void writeBinOp(ExprTag tag, T * e)
+    {
+        sink << tag;
+        write(e->pos);
+        write(e->e1);
+        write(e->e2);
+    }
+
+    void write(Expr * e)
+    {
+        if (!e)
+            sink << tagNull;
+
+        else if (auto e2 = dynamic_cast<ExprInt *>(e))
+            sink << tagInt << (uint64_t) e2->n;
+
+        else if (auto e2 = dynamic_cast<ExprFloat *>(e)) {
+            uint64_t bits;
+            static_assert(sizeof(bits) == sizeof(e2->nf));
+            memcpy(&bits, &e2->nf, sizeof(bits));
+            sink << tagFloat << bits;
+        }
+
+        else if (auto e2 = dynamic_cast<ExprString *>(e)) {
+            sink << tagString;
+            write(e2->s);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprPath *>(e))
+            sink << tagPath << e2->s;
+
+        else if (auto e2 = dynamic_cast<ExprVar *>(e)) {
+            sink << tagVar;
+            write(e2->pos);
+            write(e2->name);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprSelect *>(e)) {
+            sink << tagSelect;
+            write(e2->pos);
+            write(e2->e);
+            write(e2->def);
+            write(e2->attrPath);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprOpHasAttr *>(e)) {
+            sink << tagOpHasAttr;
+            write(e2->e);
+            write(e2->attrPath);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprAttrs *>(e)) {
+            sink << tagAttrs << e2->recursive << e2->attrs.size();
+            for (auto & i : e2->attrs) {
+                write(i.first);
+                sink << i.second.inherited;
+                write(i.second.e);
+                write(i.second.pos);
+            }
+            sink << e2->dynamicAttrs.size();
+            for (auto & i : e2->dynamicAttrs) {
+                write(i.nameExpr);
+                write(i.valueExpr);
+                write(i.pos);
+            }
+        }
+
+        else if (auto e2 = dynamic_cast<ExprList *>(e)) {
+            sink << tagList << e2->elems.size();
+            for (auto & i : e2->elems)
+                write(i);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprLambda *>(e)) {
+            sink << tagLambda;
+            write(e2->pos);
+            write(e2->name);
+            write(e2->arg);
+            sink << e2->matchAttrs;
+            if (e2->formals) {
+                sink << 1 << e2->formals->ellipsis << e2->formals->formals.size();
+                for (auto & i : e2->formals->formals) {
+                    write(i.pos);
+                    write(i.name);
+                    write(i.def);
+                }
+            } else
+                sink << 0;
+            write(e2->body);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprLet *>(e)) {
+            sink << tagLet;
+            write(e2->attrs);
+            write(e2->body);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprWith *>(e)) {
+            sink << tagWith;
+            write(e2->pos);
+            write(e2->attrs);
+            write(e2->body);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprIf *>(e)) {
+            sink << tagIf;
+            write(e2->pos);
+            write(e2->cond);
+            write(e2->then);
+            write(e2->else_);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprAssert *>(e)) {
+            sink << tagAssert;
+            write(e2->pos);
+            write(e2->cond);
+            write(e2->body);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprOpNot *>(e)) {
+            sink << tagOpNot;
+            write(e2->e);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprApp *>(e)) writeBinOp(tagApp, e2);
+        else if (auto e2 = dynamic_cast<ExprOpEq *>(e)) writeBinOp(tagOpEq, e2);
+        else if (auto e2 = dynamic_cast<ExprOpNEq *>(e)) writeBinOp(tagOpNEq, e2);
+        else if (auto e2 = dynamic_cast<ExprOpAnd *>(e)) writeBinOp(tagOpAnd, e2);
+        else if (auto e2 = dynamic_cast<ExprOpOr *>(e)) writeBinOp(tagOpOr, e2);
+        else if (auto e2 = dynamic_cast<ExprOpImpl *>(e)) writeBinOp(tagOpImpl, e2);
+        else if (auto e2 = dynamic_cast<ExprOpUpdate *>(e)) writeBinOp(tagOpUpdate, e2);
+        else if (auto e2 = dynamic_cast<ExprOpConcatLists *>(e)) writeBinOp(tagOpConcatLists, e2);
+
+        else if (auto e2 = dynamic_cast<ExprConcatStrings *>(e)) {
+            sink << tagConcatStrings;
+            write(e2->pos);
+            sink << e2->forceString << e2->es->size();
+            for (auto & i : *e2->es)
+                write(i);
+        }
+
+        else if (auto e2 = dynamic_cast<ExprPos *>(e)) {
+            sink << tagPos;
+            write(e2->pos);
+        }
+
+        else
+            throw Error("don't know how to cache expression '%s'", *e);
+    }
+};
+
+
+struct ParseCacheReader
+{
+    SymbolTable & symbols;
+    StringSource source;
+    std::vector<Symbol> syms;
+
+    ParseCacheReader(SymbolTable & symbols, const string & s)
+        : symbols(symbols), source(s)
+    { }
+
+    uint64_t readNum()
+    {
+        return nix::readNum<uint64_t>(source);
+    }
+
+    Symbol readSymbol()
+    {
+        auto n = readNum();
+        if (n == 0) return Symbol();
+        if (n <= syms.size()) return syms[n - 1];
+        if (n != syms.size() + 1)
+            throw Error("invalid symbol reference in parse cache");
+        syms.push_back(symbols.create(readString(source)));
+        return syms.back();
+    }
+
+    Pos readPos()
+    {
+        Pos pos;
+        pos.origin = (FileOrigin) readNum();
+        pos.file = readSymbol();
+        pos.line = readNum();
+        pos.column = readNum();
+        return pos;
+    }
+
+    AttrPath readAttrPath()
+    {
+        AttrPath attrPath;
+        auto size = readNum();
+        for (uint64_t n = 0; n < size; ++n) {
+            if (readNum())
+                attrPath.push_back(AttrName(readSymbol()));
+            else
+                attrPath.push_back(AttrName(readExpr()));
+        }
+        return attrPath;
+    }
+
+    template<class T>
+    Expr * readBinOp()
+    {
+        auto pos = readPos();
+        auto e1 = readExpr();
+        auto e2 = readExpr();
+        return new T(pos, e1, e2);
+    }
+
+    Expr * readExpr()
+    {
+        switch ((ExprTag) readNum()) {
+
+        case tagNull:
+            return nullptr;
+
+        case tagInt:
+            return new ExprInt((NixInt) readNum());
+
+        case tagFloat: {
+            auto bits = readNum();
+            NixFloat nf;
+            memcpy(&nf, &bits, sizeof(nf));
+            return new ExprFloat(nf);
+        }
+
+        case tagString:
+            return new ExprString(readSymbol());
+
+        case tagPath:
+            return new ExprPath(readString(source));
+
+        case tagVar: {
+            auto pos = readPos();
+            return new ExprVar(pos, readSymbol());
+        }
+
+        case tagSelect: {
+            auto pos = readPos();
+            auto e = readExpr();
+            auto def = readExpr();
+            return new ExprSelect(pos, e, readAttrPath(), def);
+        }
+
+        case tagOpHasAttr: {
+            auto e = readExpr();
+            return new ExprOpHasAttr(e, readAttrPath());
+        }
+
+        case tagAttrs:
+            return readAttrs();
+
+        case tagList: {
+            auto e = new ExprList;
+            auto size = readNum();
+            for (uint64_t n = 0; n < size; ++n)
+                e->elems.push_back(readExpr());
+            return e;
+        }
+
+        case tagLambda: {
+            auto pos = readPos();
+            auto name = readSymbol();
+            auto arg = readSymbol();
+            bool matchAttrs = readNum();
+            Formals * formals = nullptr;
+            if (readNum()) {
+                formals = new Formals;
+                formals->ellipsis = readNum();
+                auto size = readNum();
+                for (uint64_t n = 0; n < size; ++n) {
+                    auto pos = readPos();
+                    auto name = readSymbol();
+                    formals->formals.emplace_back(pos, name, readExpr());
+                    formals->argNames.insert(name);
+                }
+            }
+            auto e = new ExprLambda(pos, arg, matchAttrs, formals, readExpr());
+            if (name.set()) e->setName(name);
+            return e;
+        }
+
+        case tagLet: {
+            auto attrs = dynamic_cast<ExprAttrs *>(readExpr());
+            if (!attrs)
+                throw Error("invalid 'let' in parse cache");
+            return new ExprLet(attrs, readExpr());
+        }
+
+        case tagWith: {
+            auto pos = readPos();
+            auto attrs = readExpr();
+            return new ExprWith(pos, attrs, readExpr());
+        }
+
+        case tagIf: {
+            auto pos = readPos();
+            auto cond = readExpr();
+            auto then = readExpr();
+            return new ExprIf(pos, cond, then, readExpr());
+        }
+
+        case tagAssert: {
+            auto pos = readPos();
+            auto cond = readExpr();
+            return new ExprAssert(pos, cond, readExpr());
+        }
+
+        case tagOpNot:
+            return new ExprOpNot(readExpr());
+
+        case tagApp: return readBinOp<ExprApp>();
+        case tagOpEq: return readBinOp<ExprOpEq>();
+        case tagOpNEq: return readBinOp<ExprOpNEq>();
+        case tagOpAnd: return readBinOp<ExprOpAnd>();
+        case tagOpOr: return readBinOp<ExprOpOr>();
+        case tagOpImpl: return readBinOp<ExprOpImpl>();
+        case tagOpUpdate: return readBinOp<ExprOpUpdate>();
+        case tagOpConcatLists: return readBinOp<ExprOpConcatLists>();
+
+        case tagConcatStrings: {
+            auto pos = readPos();
+            bool forceString = readNum();
+            auto es = new vector<Expr *>;
+            auto size = readNum();
+            for (uint64_t n = 0; n < size; ++n)
+                es->push_back(readExpr());
+            return new ExprConcatStrings(pos, forceString, es);
+        }
+
+        case tagPos:
+            return new ExprPos(readPos());
+
+        default:
+            throw Error("invalid expression in parse cache");
+        }
+    }
+
+    ExprAttrs * readAttrs()
+    {
+        auto e = new ExprAttrs;
+        e->recursive = readNum();
+        auto size = readNum();
+        for (uint64_t n = 0; n < size; ++n) {
+            auto name = readSymbol();
+            bool inherited = readNum();
+            auto value = readExpr();
+            e->attrs[name] = ExprAttrs::AttrDef(value, readPos(), inherited);
+        }
+        size = readNum();
+        for (uint64_t n = 0; n < size; ++n) {
+            auto nameExpr = readExpr();
+            auto valueExpr = readExpr();
+            e->dynamicAttrs.emplace_back(nameExpr, valueExpr, readPos());
+        }
+        return e;
+    }
+};
+
+
+Path getParseCachePath(const Path & path, std::string_view text)
+{
+    static bool noURLLiterals = settings.isExperimentalFeatureEnabled("no-url-literals");
+
+    /* Anything that affects the result of the parser must be part of
+       the key. Note that '~/...' paths are expanded at parse time. */
+    std::string key;
+    for (auto & s : { std::to_string(parseCacheVersion), nixVersion, path, getHome(), std::to_string(noURLLiterals) }) {
+        key += s;
+        key.push_back(0);
+    }
+    key += text;
+
+    return getCacheDir() + "/nix/parse-cache/" + hashString(htSHA256, key).to_string(Base32, false);
+}
+
+
+Expr * readParseCache(SymbolTable & symbols, const Path & cachePath)
+{
+    if (!pathExists(cachePath)) return nullptr;
+
+    try {
+        auto data = readFile(cachePath);
+        ParseCacheReader reader(symbols, data);
+        auto e = reader.readExpr();
+        if (reader.readNum() != tagEnd)
+            throw Error("missing end marker");
+        return e;
+    } catch (Error & e) {
+        debug("ignoring invalid parse cache entry '%s': %s", cachePath, e.msg());
+        return nullptr;
+    }
+}
+
+
+void writeParseCache(const Path & cachePath, Expr * e)
+{
+    try {
+        ParseCacheWriter writer;
+        writer.write(e);
+        writer.sink << tagEnd;
+
+        createDirs(dirOf(cachePath));
+        auto tmpPath = fmt("%s.tmp-%d", cachePath, getpid());
+        writeFile(tmpPath, *writer.sink.s);
+        if (rename(tmpPath.c_str(), cachePath.c_str()) == -1)
+            throw SysError("renaming '%s' to '%s'", tmpPath, cachePath);
+    } catch (Error & e) {
+        debug("cannot write parse cache entry '%s': %s", cachePath, e.msg());
+    }
+}
+
+}
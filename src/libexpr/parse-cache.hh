@@ -0,0 +1,25 @@
+#pragma once
+
+#include "nixexpr.hh"
+
+namespace nix {
+
+/* A persistent cache of parsed Nix files, stored in
+   ~/.cache/nix/parse-cache. Entries are keyed on the file's path and
+   contents and on everything else that affects parsing (such as the
+   Nix version), so they never need to be invalidated. The cached
+   ASTs are stored before variable binding, so they can be used with
+   any static environment. */
+
+/* Return the location of the cache entry for the file 'path' with
+   contents 'text'. */
+Path getParseCachePath(const Path & path, std::string_view text);
+
+/* Read an AST from the cache entry 'cachePath'. Returns nullptr if
+   there is no (valid) entry. */
+Expr * readParseCache(SymbolTable & symbols, const Path & cachePath);
+
+/* Write the AST 'e' to the cache entry 'cachePath'. */
+void writeParseCache(const Path & cachePath, Expr * e);
+
+}
@@ -563,6 +563,7 @@ formal
 #include "eval.hh"
 #include "filetransfer.hh"
 #include "fetchers.hh"
+#include "parse-cache.hh"
 #include "store-api.hh"
 
 
@@ -572,6 +573,15 @@ namespace nix {
 Expr * EvalState::parse(const char * text, FileOrigin origin,
     const Path & path, const Path & basePath, StaticEnv & staticEnv)
 {
+    Path cachePath;
+    if (origin == foFile && evalSettings.useParseCache) {
+        cachePath = getParseCachePath(path, text);
+        if (auto e = readParseCache(symbols, cachePath)) {
+            e->bindVars(staticEnv);
+            return e;
+        }
+    }
+
     yyscan_t scanner;
     ParseData data(*this);
     data.origin = origin;
@@ -595,6 +605,9 @@ Expr * EvalState::parse(const char * text, FileOrigin origin,
 
     if (res) throw ParseError(data.error);
 
+    if (!cachePath.empty())
+        writeParseCache(cachePath, data.result);
+
     data.result->bindVars(staticEnv);
 
     return data.result;
@@ -542,11 +542,62 @@ struct CompareValues
 };
 
 
-#if HAVE_BOEHMGC
-typedef list<Value *, gc_allocator<Value *> > ValueList;
-#else
-typedef list<Value *> ValueList;
-#endif
+/* Hashing consistent with CompareValues and EvalState::eqValues, for
+   keys of unordered containers. Integers and floats with the same
+   numeric value are equal. Derivations are hashed by their output
+   path, other attribute sets by their size and attribute names;
+   attribute values are not hashed, so sets differing only in their
+   values collide. Functions hash to 0. */
+struct HashKeyValue
+{
+    EvalState & state;
+
+    HashKeyValue(EvalState & state) : state(state) { }
+
+    size_t operator () (Value * v) const
+    {
+        switch (v->type) {
+            case tInt:
+                return std::hash<NixFloat>()(v->integer);
+            case tFloat:
+                return std::hash<NixFloat>()(v->fpoint);
+            case tString:
+                return std::hash<std::string_view>()(v->string.s);
+            case tPath:
+                return std::hash<std::string_view>()(v->path);
+            case tBool:
+                return v->boolean;
+            case tList1:
+            case tList2:
+            case tListN:
+                return v->listSize();
+            case tAttrs: {
+                if (state.isDerivation(*v)) {
+                    auto i = v->attrs->find(state.sOutPath);
+                    if (i != v->attrs->end()) {
+                        state.forceValue(*i->value);
+                        return (*this)(i->value);
+                    }
+                }
+                size_t h = v->attrs->size();
+                for (auto & i : *v->attrs)
+                    h = h * 31 + std::hash<Symbol>()(i.name);
+                return h;
+            }
+            default:
+                return 0;
+        }
+    }
+};
+
+struct EqualKeyValues
+{
+    bool operator () (const Value * v1, const Value * v2) const
+    {
+        CompareValues cmp;
+        return !cmp(v1, v2) && !cmp(v2, v1);
+    }
+};
 
 
 static void prim_genericClosure(EvalState & state, const Pos & pos, Value * * args, Value & v)
@@ -563,7 +614,10 @@ static void prim_genericClosure(EvalState & state, const Pos & pos, Value * * ar
         });
     state.forceList(*startSet->value, pos);
 
-    ValueList workSet;
+    /* The work set is a queue; elements before 'next' have been
+       processed. */
+    ValueVector workSet;
+    size_t next = 0;
     for (unsigned int n = 0; n < startSet->value->listSize(); ++n)
         workSet.push_back(startSet->value->listElems()[n]);
 
@@ -580,18 +634,18 @@ static void prim_genericClosure(EvalState & state, const Pos & pos, Value * * ar
     /* Construct the closure by applying the operator to element of
        `workSet', adding the result to `workSet', continuing until
        no new elements are found. */
-    ValueList res;
+    ValueVector res;
     // `doneKeys' doesn't need to be a GC root, because its values are
     // reachable from res.
-    set<Value *, CompareValues> doneKeys;
-    while (!workSet.empty()) {
-        Value * e = *(workSet.begin());
-        workSet.pop_front();
+    std::unordered_set<Value *, HashKeyValue, EqualKeyValues> doneKeys(0, HashKeyValue(state));
+    Value * firstKey = nullptr;
+    Symbol sKey = state.symbols.create("key");
+    while (next < workSet.size()) {
+        Value * e = workSet[next++];
 
         state.forceAttrs(*e, pos);
 
-        Bindings::iterator key =
-            e->attrs->find(state.symbols.create("key"));
+        Bindings::iterator key = e->attrs->find(sKey);
         if (key == e->attrs->end())
             throw EvalError({
                 .hint = hintfmt("attribute 'key' required"),
@@ -599,6 +653,12 @@ static void prim_genericClosure(EvalState & state, const Pos & pos, Value * * ar
             });
         state.forceValue(*key->value, pos);
 
+        /* Keys must be mutually comparable. */
+        if (firstKey)
+            CompareValues()(firstKey, key->value);
+        else
+            firstKey = key->value;
+
         if (!doneKeys.insert(key->value).second) continue;
         res.push_back(e);
 
@@ -685,10 +745,10 @@ static void prim_tryEval(EvalState & state, const Pos & pos, Value * * args, Val
     try {
         state.forceValue(*args[0], pos);
         v.attrs->push_back(Attr(state.sValue, args[0]));
-        mkBool(*state.allocAttr(v, state.symbols.create("success")), true);
+        v.attrs->push_back(Attr(state.symbols.create("success"), state.allocBool(true)));
     } catch (AssertionError & e) {
-        mkBool(*state.allocAttr(v, state.sValue), false);
-        mkBool(*state.allocAttr(v, state.symbols.create("success")), false);
+        v.attrs->push_back(Attr(state.sValue, state.allocBool(false)));
+        v.attrs->push_back(Attr(state.symbols.create("success"), state.allocBool(false)));
     }
     v.attrs->sort();
 }
@@ -1089,7 +1149,7 @@ static void prim_derivationStrict(EvalState & state, const Pos & pos, Value * *
 
         // Regular, non-CA derivation should always return a single hash and not
         // hash per output.
-        auto hashModulo = hashDerivationModulo(*state.store, Derivation(drv), true);
+        auto hashModulo = hashDerivationModulo(*state.store, drv, true);
         std::visit(overloaded {
             [&](Hash h) {
                 for (auto & i : outputs) {
@@ -1133,7 +1193,7 @@ static void prim_derivationStrict(EvalState & state, const Pos & pos, Value * *
        However, we don't bother doing this for floating CA derivations because
        their "hash modulo" is indeterminate until built. */
     if (drv.type() != DerivationType::CAFloating) {
-        auto h = hashDerivationModulo(*state.store, Derivation(drv), false);
+        auto h = hashDerivationModulo(*state.store, drv, false);
         drvHashes.lock()->insert_or_assign(drvPath, h);
     }
 
@@ -2133,9 +2193,12 @@ static void prim_listToAttrs(EvalState & state, const Pos & pos, Value * * args,
 {
     state.forceList(*args[0], pos);
 
-    state.mkAttrs(v, args[0]->listSize());
-
-    std::set<Symbol> seen;
+    /* Collect all pairs, then sort them by name. Since the sort is
+       stable, the first occurrence of each name is the first in its
+       run of equal names. `attrs' doesn't need to be a GC root,
+       because its values are reachable from the argument. */
+    std::vector<Attr> attrs;
+    attrs.reserve(args[0]->listSize());
 
     for (unsigned int i = 0; i < args[0]->listSize(); ++i) {
         Value & v2(*args[0]->listElems()[i]);
@@ -2149,19 +2212,30 @@ static void prim_listToAttrs(EvalState & state, const Pos & pos, Value * * args,
             });
         string name = state.forceStringNoCtx(*j->value, pos);
 
-        Symbol sym = state.symbols.create(name);
-        if (seen.insert(sym).second) {
-            Bindings::iterator j2 = v2.attrs->find(state.symbols.create(state.sValue));
-            if (j2 == v2.attrs->end())
-                throw TypeError({
-                    .hint = hintfmt("'value' attribute missing in a call to 'listToAttrs'"),
-                    .errPos = pos
-                });
-            v.attrs->push_back(Attr(sym, j2->value, j2->pos));
-        }
+        /* A missing 'value' is only an error for the occurrence that
+           is kept. */
+        Bindings::iterator j2 = v2.attrs->find(state.sValue);
+        if (j2 == v2.attrs->end())
+            attrs.push_back(Attr(state.symbols.create(name), nullptr));
+        else
+            attrs.push_back(Attr(state.symbols.create(name), j2->value, j2->pos));
     }
 
-    v.attrs->sort();
+    std::stable_sort(attrs.begin(), attrs.end());
+    attrs.erase(std::unique(attrs.begin(), attrs.end(),
+            [](const Attr & a, const Attr & b) { return a.name == b.name; }),
+        attrs.end());
+
+    state.mkAttrs(v, attrs.size());
+
+    for (auto & attr : attrs) {
+        if (!attr.value)
+            throw TypeError({
+                .hint = hintfmt("'value' attribute missing in a call to 'listToAttrs'"),
+                .errPos = pos
+            });
+        v.attrs->push_back(attr);
+    }
 }
 
 static RegisterPrimOp primop_listToAttrs({
@@ -2270,12 +2344,8 @@ static void prim_functionArgs(EvalState & state, const Pos & pos, Value * * args
     }
 
     state.mkAttrs(v, args[0]->lambda.fun->formals->formals.size());
-    for (auto & i : args[0]->lambda.fun->formals->formals) {
-        // !!! should optimise booleans (allocate only once)
-        Value * value = state.allocValue();
-        v.attrs->push_back(Attr(i.name, value, &i.pos));
-        mkBool(*value, i.def);
-    }
+    for (auto & i : args[0]->lambda.fun->formals->formals)
+        v.attrs->push_back(Attr(i.name, state.allocBool(i.def), &i.pos));
     v.attrs->sort();
 }
 
@@ -2406,9 +2476,7 @@ static void prim_tail(EvalState & state, const Pos & pos, Value * * args, Value
             .errPos = pos
         });
 
-    state.mkList(v, args[0]->listSize() - 1);
-    for (unsigned int n = 0; n < v.listSize(); ++n)
-        v.listElems()[n] = args[0]->listElems()[n + 1];
+    state.mkListSlice(v, *args[0], 1, args[0]->listSize() - 1);
 }
 
 static RegisterPrimOp primop_tail({
@@ -2467,18 +2535,25 @@ static void prim_filter(EvalState & state, const Pos & pos, Value * * args, Valu
     Value * vs[args[1]->listSize()];
     unsigned int k = 0;
 
-    bool same = true;
+    /* If the elements that pass the filter are adjacent, the result
+       can share the elements of the input list. */
+    bool same = true, contiguous = true;
+    size_t first = 0;
     for (unsigned int n = 0; n < args[1]->listSize(); ++n) {
         Value res;
         state.callFunction(*args[0], *args[1]->listElems()[n], res, noPos);
-        if (state.forceBool(res, pos))
+        if (state.forceBool(res, pos)) {
+            if (k == 0) first = n;
+            else if (first + k != n) contiguous = false;
             vs[k++] = args[1]->listElems()[n];
-        else
+        } else
             same = false;
     }
 
     if (same)
         v = *args[1];
+    else if (contiguous && k)
+        state.mkListSlice(v, *args[1], first, k);
     else {
         state.mkList(v, k);
         for (unsigned int n = 0; n < k; ++n) v.listElems()[n] = vs[n];
@@ -2647,11 +2722,8 @@ static void prim_genList(EvalState & state, const Pos & pos, Value * * args, Val
 
     state.mkList(v, len);
 
-    for (unsigned int n = 0; n < (unsigned int) len; ++n) {
-        Value * arg = state.allocValue();
-        mkInt(*arg, n);
-        mkApp(*(v.listElems()[n] = state.allocValue()), *args[0], *arg);
-    }
+    for (unsigned int n = 0; n < (unsigned int) len; ++n)
+        mkApp(*(v.listElems()[n] = state.allocValue()), *args[0], *state.allocInt(n));
 }
 
 static RegisterPrimOp primop_genList({
@@ -2725,6 +2797,56 @@ static RegisterPrimOp primop_sort({
     .fun = prim_sort,
 });
 
+static void prim_sortOn(EvalState & state, const Pos & pos, Value * * args, Value & v)
+{
+    state.forceFunction(*args[0], pos);
+    state.forceList(*args[1], pos);
+
+    auto len = args[1]->listSize();
+
+    /* Compute the key of each element once, rather than once per
+       comparison. */
+    ValueVector keys;
+    keys.reserve(len);
+    std::vector<unsigned int> order(len);
+    for (unsigned int n = 0; n < len; ++n) {
+        Value * vKey = state.allocValue();
+        state.callFunction(*args[0], *args[1]->listElems()[n], *vKey, pos);
+        state.forceValue(*vKey, pos);
+        keys.push_back(vKey);
+        order[n] = n;
+    }
+
+    std::stable_sort(order.begin(), order.end(), [&](unsigned int a, unsigned int b) {
+        return CompareValues()(keys[a], keys[b]);
+    });
+
+    state.mkList(v, len);
+    for (unsigned int n = 0; n < len; ++n)
+        v.listElems()[n] = args[1]->listElems()[order[n]];
+}
+
+static RegisterPrimOp primop_sortOn({
+    .name = "__sortOn",
+    .args = {"f", "list"},
+    .doc = R"(
+      Return *list* sorted by the keys obtained by applying *f* to each
+      element. The keys must be numbers, strings or paths, and are
+      compared as with the `<` operator. *f* is called only once per
+      element. For example,
+
+      ```nix
+      builtins.sortOn (p: p.age) [ { name = "a"; age = 42; } { name = "b"; age = 23; } ]
+      ```
+
+      evaluates to `[ { name = "b"; age = 23; } { name = "a"; age = 42; } ]`.
+
+      This is a stable sort: it preserves the relative order of elements
+      with equal keys.
+    )",
+    .fun = prim_sortOn,
+});
+
 static void prim_partition(EvalState & state, const Pos & pos, Value * * args, Value & v)
 {
     state.forceFunction(*args[0], pos);
@@ -2785,6 +2907,99 @@ static RegisterPrimOp primop_partition({
     .fun = prim_partition,
 });
 
+static void prim_unique(EvalState & state, const Pos & pos, Value * * args, Value & v)
+{
+    state.forceList(*args[0], pos);
+
+    auto len = args[0]->listSize();
+
+    auto equal = [&](Value * v1, Value * v2) {
+        return state.eqValues(*v1, *v2);
+    };
+    std::unordered_set<Value *, HashKeyValue, decltype(equal)> seen(len, HashKeyValue(state), equal);
+
+    ValueVector res;
+    for (unsigned int n = 0; n < len; ++n) {
+        auto vElem = args[0]->listElems()[n];
+        state.forceValue(*vElem, pos);
+        if (seen.insert(vElem).second)
+            res.push_back(vElem);
+    }
+
+    state.mkList(v, res.size());
+    if (res.size())
+        memcpy(v.listElems(), res.data(), sizeof(Value *) * res.size());
+}
+
+static RegisterPrimOp primop_unique({
+    .name = "__unique",
+    .args = {"list"},
+    .doc = R"(
+      Return *list* with all but the first occurrence of each element
+      removed. Elements are compared as with the `==` operator. For
+      example,
+
+      ```nix
+      builtins.unique [ 3 1 3 2 1 ]
+      ```
+
+      evaluates to `[ 3 1 2 ]`.
+    )",
+    .fun = prim_unique,
+});
+
+static void prim_groupBy(EvalState & state, const Pos & pos, Value * * args, Value & v)
+{
+    state.forceFunction(*args[0], pos);
+    state.forceList(*args[1], pos);
+
+    std::unordered_map<Symbol, size_t> index;
+    std::vector<ValueVector> groups;
+
+    for (unsigned int n = 0; n < args[1]->listSize(); ++n) {
+        auto vElem = args[1]->listElems()[n];
+        Value vKey;
+        state.callFunction(*args[0], *vElem, vKey, pos);
+        auto name = state.symbols.create(state.forceStringNoCtx(vKey, pos));
+        auto i = index.emplace(name, groups.size());
+        if (i.second) groups.emplace_back();
+        groups[i.first->second].push_back(vElem);
+    }
+
+    state.mkAttrs(v, groups.size());
+
+    for (auto & [name, i] : index) {
+        auto & group(groups[i]);
+        Value * vGroup = state.allocAttr(v, name);
+        state.mkList(*vGroup, group.size());
+        memcpy(vGroup->listElems(), group.data(), sizeof(Value *) * group.size());
+    }
+
+    v.attrs->sort();
+}
+
+static RegisterPrimOp primop_groupBy({
+    .name = "__groupBy",
+    .args = {"f", "list"},
+    .doc = R"(
+      Group the elements of *list* by the string returned by applying
+      *f* to each element. The result is a set mapping each such string
+      to the list of elements that produced it, in their original
+      order. For example,
+
+      ```nix
+      builtins.groupBy (x: if x > 2 then "big" else "small") [ 1 5 2 7 ]
+      ```
+
+      evaluates to
+
+      ```nix
+      { big = [ 5 7 ]; small = [ 1 2 ]; }
+      ```
+    )",
+    .fun = prim_groupBy,
+});
+
 static void prim_concatMap(EvalState & state, const Pos & pos, Value * * args, Value & v)
 {
     state.forceFunction(*args[0], pos);
@@ -3109,7 +3324,18 @@ static RegisterPrimOp primop_hashString({
 
 struct RegexCache
 {
+    /* Each evaluator has its own cache, so no locking is needed, and
+       the cache doesn't outlive the evaluator. Map nodes don't move,
+       so references to them stay valid. */
     std::unordered_map<std::string, std::regex> cache;
+
+    const std::regex & get(const std::string & re)
+    {
+        auto i = cache.find(re);
+        if (i == cache.end())
+            i = cache.emplace(re, std::regex(re, std::regex::extended)).first;
+        return i->second;
+    }
 };
 
 std::shared_ptr<RegexCache> makeRegexCache()
@@ -3123,15 +3349,13 @@ void prim_match(EvalState & state, const Pos & pos, Value * * args, Value & v)
 
     try {
 
-        auto regex = state.regexCache->cache.find(re);
-        if (regex == state.regexCache->cache.end())
-            regex = state.regexCache->cache.emplace(re, std::regex(re, std::regex::extended)).first;
+        auto & regex = state.regexCache->get(re);
 
         PathSet context;
         const std::string str = state.forceString(*args[1], context, pos);
 
         std::smatch match;
-        if (!std::regex_match(str, match, regex->second)) {
+        if (!std::regex_match(str, match, regex)) {
             mkNull(v);
             return;
         }
@@ -3141,7 +3365,7 @@ void prim_match(EvalState & state, const Pos & pos, Value * * args, Value & v)
         state.mkList(v, len);
         for (size_t i = 0; i < len; ++i) {
             if (!match[i+1].matched)
-                mkNull(*(v.listElems()[i] = state.allocValue()));
+                v.listElems()[i] = state.allocNull();
             else
                 mkString(*(v.listElems()[i] = state.allocValue()), match[i + 1].str().c_str());
         }
@@ -3200,13 +3424,13 @@ static RegisterPrimOp primop_match({
 
 /* Split a string with a regular expression, and return a list of the
    non-matching parts interleaved by the lists of the matching groups. */
-static void prim_split(EvalState & state, const Pos & pos, Value * * args, Value & v)
+void prim_split(EvalState & state, const Pos & pos, Value * * args, Value & v)
 {
     auto re = state.forceStringNoCtx(*args[0], pos);
 
     try {
 
-        std::regex regex(re, std::regex::extended);
+        auto & regex = state.regexCache->get(re);
 
         PathSet context;
         const std::string str = state.forceString(*args[1], context, pos);
@@ -3241,7 +3465,7 @@ static void prim_split(EvalState & state, const Pos & pos, Value * * args, Value
             state.mkList(*elem, slen);
             for (size_t si = 0; si < slen; ++si) {
                 if (!match[si + 1].matched)
-                    mkNull(*(elem->listElems()[si] = state.allocValue()));
+                    elem->listElems()[si] = state.allocNull();
                 else
                     mkString(*(elem->listElems()[si] = state.allocValue()), match[si + 1].str().c_str());
             }
@@ -3309,21 +3533,20 @@ static RegisterPrimOp primop_split({
 
 static void prim_concatStringsSep(EvalState & state, const Pos & pos, Value * * args, Value & v)
 {
-    PathSet context;
+    StringConcat res;
 
-    auto sep = state.forceString(*args[0], context, pos);
+    auto sep = state.forceString(*args[0], res.context, pos);
     state.forceList(*args[1], pos);
 
-    string res;
-    res.reserve((args[1]->listSize() + 32) * sep.size());
+    res.s.reserve((args[1]->listSize() + 32) * sep.size());
     bool first = true;
 
     for (unsigned int n = 0; n < args[1]->listSize(); ++n) {
-        if (first) first = false; else res += sep;
-        res += state.coerceToString(pos, *args[1]->listElems()[n], context);
+        if (first) first = false; else res.s += sep;
+        res.add(state, pos, *args[1]->listElems()[n]);
     }
 
-    mkString(v, res, context);
+    res.mkString(v);
 }
 
 static RegisterPrimOp primop_concatStringsSep({
@@ -111,9 +111,9 @@ static void prim_getContext(EvalState & state, const Pos & pos, Value * * args,
         auto & infoVal = *state.allocAttr(v, state.symbols.create(info.first));
         state.mkAttrs(infoVal, 3);
         if (info.second.path)
-            mkBool(*state.allocAttr(infoVal, sPath), true);
+            infoVal.attrs->push_back(Attr(sPath, state.allocBool(true)));
         if (info.second.allOutputs)
-            mkBool(*state.allocAttr(infoVal, sAllOutputs), true);
+            infoVal.attrs->push_back(Attr(sAllOutputs, state.allocBool(true)));
         if (!info.second.outputs.empty()) {
             auto & outputsVal = *state.allocAttr(infoVal, state.sOutputs);
             state.mkList(outputsVal, info.second.outputs.size());
@@ -1,7 +1,8 @@
 #pragma once
 
+#include <deque>
 #include <map>
-#include <unordered_set>
+#include <unordered_map>
 
 #include "types.hh"
 
@@ -64,26 +65,44 @@ public:
         return s->empty();
     }
 
+    /* Hash suitable for hash tables keyed on symbols. Since symbols
+       are unique, this is just the address of the string. */
+    size_t hash() const
+    {
+        return (size_t) s;
+    }
+
     friend std::ostream & operator << (std::ostream & str, const Symbol & sym);
 };
 
+/* The symbol table stores the strings themselves in a deque, so they
+   are allocated in large blocks and never move, and indexes them with
+   a hash map keyed on string views into that storage. This allows
+   looking up an existing symbol without constructing a std::string. */
 class SymbolTable
 {
 private:
-    typedef std::unordered_set<string> Symbols;
-    Symbols symbols;
+    std::unordered_map<std::string_view, Symbol> symbols;
+    std::deque<string> store;
 
 public:
+    SymbolTable() { }
+    SymbolTable(const SymbolTable &) = delete;
+
     Symbol create(std::string_view s)
     {
-        // FIXME: avoid allocation if 's' already exists in the symbol table.
-        std::pair<Symbols::iterator, bool> res = symbols.emplace(std::string(s));
-        return Symbol(&*res.first);
+        auto it = symbols.find(s);
+        if (it != symbols.end()) return it->second;
+
+        const string & rawSym = store.emplace_back(s);
+        Symbol sym(&rawSym);
+        symbols.emplace(rawSym, sym);
+        return sym;
     }
 
     size_t size() const
     {
-        return symbols.size();
+        return store.size();
     }
 
     size_t totalSize() const;
@@ -91,9 +110,20 @@ public:
     template<typename T>
     void dump(T callback)
     {
-        for (auto & s : symbols)
+        for (auto & s : store)
             callback(s);
     }
 };
 
 }
+
+namespace std {
+
+template<> struct hash<nix::Symbol> {
+    std::size_t operator()(const nix::Symbol & sym) const noexcept
+    {
+        return sym.hash();
+    }
+};
+
+}
@@ -123,8 +123,13 @@ struct Value
 
         const char * path;
         Bindings * attrs;
+        /* The elements of a big list are 'elems[offset]' to
+           'elems[offset + size - 1]'. Since 'elems' always points to
+           the start of the array (we don't look for interior pointers
+           during garbage collection), lists that are slices of other
+           lists (such as the result of 'tail') can share the array. */
         struct {
-            size_t size;
+            uint32_t size, offset;
             Value * * elems;
         } bigList;
         Value * smallList[2];
@@ -154,12 +159,12 @@ struct Value
 
     Value * * listElems()
     {
-        return type == tList1 || type == tList2 ? smallList : bigList.elems;
+        return type == tList1 || type == tList2 ? smallList : bigList.elems + bigList.offset;
     }
 
     const Value * const * listElems() const
     {
-        return type == tList1 || type == tList2 ? smallList : bigList.elems;
+        return type == tList1 || type == tList2 ? smallList : bigList.elems + bigList.offset;
     }
 
     size_t listSize() const
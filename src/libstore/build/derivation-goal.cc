@@ -13,6 +13,7 @@
 #include "worker-protocol.hh"
 #include "topo-sort.hh"
 #include "callback.hh"
+#include "thread-pool.hh"
 
 #include <regex>
 #include <queue>
@@ -2916,6 +2917,7 @@ void DerivationGoal::registerOutputs()
     struct PerhapsNeedToRegister { StorePathSet refs; };
     std::map<std::string, std::variant<AlreadyRegistered, PerhapsNeedToRegister>> outputReferencesIfUnregistered;
     std::map<std::string, struct stat> outputStats;
+    std::map<std::string, Path> outputsToScan;
     for (auto & [outputName, _] : drv->outputs) {
         auto actualPath = toRealPathChroot(worker.store.printStorePath(scratchOutputs.at(outputName)));
 
@@ -2960,17 +2962,36 @@ void DerivationGoal::registerOutputs()
            something like that. */
         canonicalisePathMetaData(actualPath, buildUser ? buildUser->getUID() : -1, inodesSeen);
 
-        debug("scanning for references for output '%s' in temp location '%s'", outputName, actualPath);
+        outputsToScan.insert_or_assign(outputName, actualPath);
+        outputStats.insert_or_assign(outputName, std::move(st));
+    }
+
+    /* Scan the outputs for references. Outputs are independent at
+       this stage, so they are scanned concurrently. */
+    {
+        auto referenceablePathsS = worker.store.printStorePathSet(referenceablePaths);
+        Sync<std::map<std::string, StorePathSet>> outputReferences;
 
-        /* Pass blank Sink as we are not ready to hash data at this stage. */
-        NullSink blank;
-        auto references = worker.store.parseStorePathSet(
-            scanForReferences(blank, actualPath, worker.store.printStorePathSet(referenceablePaths)));
+        ThreadPool pool(std::min(outputsToScan.size(), (size_t) std::max(std::thread::hardware_concurrency(), 1U)));
 
-        outputReferencesIfUnregistered.insert_or_assign(
-            outputName,
-            PerhapsNeedToRegister { .refs = references });
-        outputStats.insert_or_assign(outputName, std::move(st));
+        for (auto & [outputName, actualPath] : outputsToScan)
+            pool.enqueue([&, outputName(outputName), actualPath(actualPath)]() {
+                debug("scanning for references for output '%s' in temp location '%s'", outputName, actualPath);
+
+                /* Pass blank Sink as we are not ready to hash data at this stage. */
+                NullSink blank;
+                auto references = worker.store.parseStorePathSet(
+                    scanForReferences(blank, actualPath, referenceablePathsS));
+
+                outputReferences.lock()->insert_or_assign(outputName, std::move(references));
+            });
+
+        pool.process();
+
+        for (auto & [outputName, references] : *outputReferences.lock())
+            outputReferencesIfUnregistered.insert_or_assign(
+                outputName,
+                PerhapsNeedToRegister { .refs = std::move(references) });
     }
 
     auto sortedOutputNames = topoSort(outputsToSort,
@@ -4,6 +4,7 @@
 #include "util.hh"
 #include "worker-protocol.hh"
 #include "fs-accessor.hh"
+#include "drv-hash-cache.hh"
 
 namespace nix {
 
@@ -468,12 +469,30 @@ static const DrvHashModulo pathDerivationModulo(Store & store, const StorePath &
             return h->second;
         }
     }
+    auto diskCache = getDrvHashCache();
+    if (diskCache) {
+        try {
+            if (auto h = diskCache->lookup(store.storeDir, drvPath)) {
+                drvHashes.lock()->insert_or_assign(drvPath, *h);
+                return *h;
+            }
+        } catch (Error & e) {
+            debug("ignoring derivation hash cache entry for '%s': %s", store.printStorePath(drvPath), e.msg());
+        }
+    }
     auto h = hashDerivationModulo(
         store,
         store.readInvalidDerivation(drvPath),
         false);
     // Cache it
     drvHashes.lock()->insert_or_assign(drvPath, h);
+    if (diskCache) {
+        try {
+            diskCache->upsert(store.storeDir, drvPath, h);
+        } catch (Error & e) {
+            debug("cannot write derivation hash cache entry for '%s': %s", store.printStorePath(drvPath), e.msg());
+        }
+    }
     return h;
 }
 
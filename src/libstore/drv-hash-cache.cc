@@ -0,0 +1,146 @@
+#include "drv-hash-cache.hh"
+#include "sync.hh"
+#include "sqlite.hh"
+#include "globals.hh"
+
+#include <sqlite3.h>
+
+namespace nix {
+
+static const char * schema = R"sql(
+
+create table if not exists DrvHashes (
+    version   text not null,
+    storeDir  text not null,
+    path      text not null,
+    type      integer not null,
+    hashes    text not null,
+    primary key (version, storeDir, path)
+);
+
+)sql";
+
+/* Bump this whenever the result of hashDerivationModulo() changes
+   without a change of nixVersion (e.g. in a development build). Both
+   are part of the 'version' column, so that Nix versions sharing the
+   cache (e.g. a client and the daemon) never use each other's
+   entries. */
+static const int drvHashVersion = 1;
+
+static std::string cacheVersion()
+{
+    return std::to_string(drvHashVersion) + ":" + nixVersion;
+}
+
+/* Values of the 'type' column. */
+enum { htDrvHash = 0, htOutputHashes = 1 };
+
+class DrvHashCacheImpl : public DrvHashCache
+{
+public:
+
+    struct State
+    {
+        SQLite db;
+        SQLiteStmt insertHash, queryHash;
+    };
+
+    Sync<State> _state;
+
+    DrvHashCacheImpl()
+    {
+        auto state(_state.lock());
+
+        Path dbPath = getCacheDir() + "/nix/drv-hashes-v2.sqlite";
+        createDirs(dirOf(dbPath));
+
+        state->db = SQLite(dbPath);
+
+        state->db.isCache();
+
+        state->db.exec(schema);
+
+        state->insertHash.create(state->db,
+            "insert or replace into DrvHashes(version, storeDir, path, type, hashes) values (?, ?, ?, ?, ?)");
+
+        state->queryHash.create(state->db,
+            "select type, hashes from DrvHashes where version = ? and storeDir = ? and path = ?");
+    }
+
+    std::optional<DrvHashModulo> lookup(
+        const Path & storeDir, const StorePath & drvPath) override
+    {
+        return retrySQLite<std::optional<DrvHashModulo>>([&]() -> std::optional<DrvHashModulo> {
+            auto state(_state.lock());
+
+            auto queryHash(state->queryHash.use()
+                (cacheVersion())
+                (storeDir)
+                (std::string(drvPath.to_string())));
+
+            if (!queryHash.next()) return std::nullopt;
+
+            auto type = queryHash.getInt(0);
+            auto hashes = queryHash.getStr(1);
+
+            if (type == htDrvHash)
+                return Hash::parseAnyPrefixed(hashes);
+
+            /* One 'output:type:hash' entry per line. */
+            CaOutputHashes outputHashes;
+            for (auto & line : tokenizeString<Strings>(hashes, "\n")) {
+                auto colon = line.find(':');
+                if (colon == std::string::npos)
+                    throw Error("invalid entry '%s' in derivation hash cache", line);
+                outputHashes.insert_or_assign(
+                    line.substr(0, colon),
+                    Hash::parseAnyPrefixed(line.substr(colon + 1)));
+            }
+            return outputHashes;
+        });
+    }
+
+    void upsert(
+        const Path & storeDir, const StorePath & drvPath, const DrvHashModulo & hash) override
+    {
+        int type;
+        std::string hashes;
+
+        if (auto h = std::get_if<Hash>(&hash)) {
+            type = htDrvHash;
+            hashes = h->to_string(Base16, true);
+        } else if (auto outputHashes = std::get_if<CaOutputHashes>(&hash)) {
+            type = htOutputHashes;
+            for (auto & [output, h] : *outputHashes)
+                hashes += output + ":" + h.to_string(Base16, true) + "\n";
+        } else
+            return;
+
+        retrySQLite<void>([&]() {
+            auto state(_state.lock());
+
+            state->insertHash.use()
+                (cacheVersion())
+                (storeDir)
+                (std::string(drvPath.to_string()))
+                (type)
+                (hashes)
+                .exec();
+        });
+    }
+};
+
+std::shared_ptr<DrvHashCache> getDrvHashCache()
+{
+    static std::shared_ptr<DrvHashCache> cache = []() -> std::shared_ptr<DrvHashCache> {
+        try {
+            return std::make_shared<DrvHashCacheImpl>();
+        } catch (Error & e) {
+            debug("cannot open derivation hash cache: %s", e.msg());
+            return nullptr;
+        }
+    }();
+    return cache;
+}
+
+}
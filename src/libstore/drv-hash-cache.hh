@@ -0,0 +1,34 @@
+#pragma once
+
+#include "derivations.hh"
+
+namespace nix {
+
+/* A persistent memo table for hashDerivationModulo(), keyed on Nix
+   version, store directory and derivation path. Since a store
+   derivation's path is determined by its contents, an entry can only
+   become stale if hashDerivationModulo() itself changes, which the
+   version takes care of. It is
+   consulted when the in-memory table (drvHashes) misses, which saves
+   reading and rehashing the closure of a derivation whose inputs
+   were not instantiated by the current process. */
+class DrvHashCache
+{
+public:
+
+    virtual ~DrvHashCache() { }
+
+    virtual std::optional<DrvHashModulo> lookup(
+        const Path & storeDir, const StorePath & drvPath) = 0;
+
+    /* Record a hash. Unknown hashes (of floating content-addressed
+       derivations and their dependents) are not recorded. */
+    virtual void upsert(
+        const Path & storeDir, const StorePath & drvPath, const DrvHashModulo & hash) = 0;
+};
+
+/* Return a singleton cache object that can be used concurrently by
+   multiple threads, or nullptr if the cache cannot be opened. */
+std::shared_ptr<DrvHashCache> getDrvHashCache();
+
+}
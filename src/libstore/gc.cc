@@ -3,16 +3,22 @@
 #include "local-store.hh"
 #include "local-fs-store.hh"
 #include "finally.hh"
+#include "sqlite.hh"
 
 #include <functional>
+#include <condition_variable>
 #include <queue>
+#include <thread>
 #include <algorithm>
 #include <regex>
 #include <random>
 
+#include <poll.h>
 #include <sys/types.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/un.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -22,15 +28,17 @@ namespace nix {
 
 
 static string gcLockName = "gc.lock";
+static string gcSocketPath = "gc-socket/socket";
 static string gcRootsDir = "gcroots";
 
 
 /* Acquire the global GC lock.  This is used to prevent new Nix
    processes from starting after the temporary root files have been
-   read.  To be precise: when they try to create a new temporary root
-   file, they will block until the garbage collector has finished /
-   yielded the GC lock. */
-AutoCloseFD LocalStore::openGCLock(LockType lockType)
+   read.  To be precise: when they add a new temporary root, they
+   either send it to the garbage collector through its socket or, if
+   that isn't possible, block until the garbage collector has
+   finished / yielded the GC lock. */
+AutoCloseFD LocalStore::openGCLock(LockType lockType, bool wait)
 {
     Path fnGCLock = (format("%1%/%2%")
         % stateDir % gcLockName).str();
@@ -42,6 +50,7 @@ AutoCloseFD LocalStore::openGCLock(LockType lockType)
         throw SysError("opening global GC lock '%1%'", fnGCLock);
 
     if (!lockFile(fdGCLock.get(), lockType, false)) {
+        if (!wait) return AutoCloseFD();
         printInfo("waiting for the big garbage collector lock...");
         lockFile(fdGCLock.get(), lockType, true);
     }
@@ -111,53 +120,126 @@ Path LocalFSStore::addPermRoot(const StorePath & storePath, const Path & _gcRoot
 }
 
 
-void LocalStore::addTempRoot(const StorePath & path)
+/* Connect to the socket of a running garbage collector. Return an
+   invalid descriptor if the collector cannot be reached (e.g. because
+   it doesn't accept roots this way). */
+static AutoCloseFD connectToGC(const Path & socketPath)
 {
-    auto state(_state.lock());
+    AutoCloseFD fd = socket(PF_UNIX, SOCK_STREAM
+        #ifdef SOCK_CLOEXEC
+        | SOCK_CLOEXEC
+        #endif
+        , 0);
+    if (!fd)
+        throw SysError("cannot create Unix domain socket");
+    closeOnExec(fd.get());
+
+    struct sockaddr_un addr;
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() + 1 >= sizeof(addr.sun_path)) return AutoCloseFD();
+    strcpy(addr.sun_path, socketPath.c_str());
+
+    if (connect(fd.get(), (struct sockaddr *) &addr, sizeof(addr)) == -1)
+        return AutoCloseFD();
+
+    return fd;
+}
+
+
+/* Send a new temporary root to the garbage collector and wait for it
+   to be acknowledged. Return false if the connection is broken. */
+static bool sendRootToGC(int fd, const Path & path)
+{
+    try {
+        debug("sending temporary root '%s' to the garbage collector", path);
+        writeFull(fd, path + "\n");
+        char c;
+        return read(fd, &c, 1) == 1 && c == '1';
+    } catch (SysError & e) {
+        debug("cannot send temporary root to the garbage collector: %s", e.msg());
+        return false;
+    }
+}
 
-    /* Create the temporary roots file for this process. */
-    if (!state->fdTempRoots) {
 
-        while (1) {
-            AutoCloseFD fdGCLock = openGCLock(ltRead);
+void LocalStore::addTempRoot(const StorePath & path)
+{
+    {
+        auto state(_state.lock());
 
-            if (pathExists(fnTempRoots))
-                /* It *must* be stale, since there can be no two
-                   processes with the same pid. */
-                unlink(fnTempRoots.c_str());
+        /* Create the temporary roots file for this process. */
+        if (!state->fdTempRoots) {
 
-            state->fdTempRoots = openLockFile(fnTempRoots, true);
+            while (1) {
+                if (pathExists(fnTempRoots))
+                    /* It *must* be stale, since there can be no two
+                       processes with the same pid. */
+                    unlink(fnTempRoots.c_str());
 
-            fdGCLock = -1;
+                state->fdTempRoots = openLockFile(fnTempRoots, true);
 
-            debug(format("acquiring read lock on '%1%'") % fnTempRoots);
-            lockFile(state->fdTempRoots.get(), ltRead, true);
+                debug(format("acquiring read lock on '%1%'") % fnTempRoots);
+                lockFile(state->fdTempRoots.get(), ltRead, true);
 
-            /* Check whether the garbage collector didn't get in our
-               way. */
-            struct stat st;
-            if (fstat(state->fdTempRoots.get(), &st) == -1)
-                throw SysError("statting '%1%'", fnTempRoots);
-            if (st.st_size == 0) break;
+                /* Check whether the garbage collector didn't get in our
+                   way. */
+                struct stat st;
+                if (fstat(state->fdTempRoots.get(), &st) == -1)
+                    throw SysError("statting '%1%'", fnTempRoots);
+                if (st.st_size == 0) break;
+
+                /* The garbage collector deleted this file before we could
+                   get a lock.  (It won't delete the file after we get a
+                   lock.)  Try again. */
+            }
 
-            /* The garbage collector deleted this file before we could
-               get a lock.  (It won't delete the file after we get a
-               lock.)  Try again. */
         }
 
+        /* Upgrade the lock to a write lock.  This will cause us to block
+           if the garbage collector is holding our lock. */
+        debug(format("acquiring write lock on '%1%'") % fnTempRoots);
+        lockFile(state->fdTempRoots.get(), ltWrite, true);
+
+        string s = printStorePath(path) + '\0';
+        writeFull(state->fdTempRoots.get(), s);
+
+        /* Downgrade to a read lock. */
+        debug(format("downgrading to read lock on '%1%'") % fnTempRoots);
+        lockFile(state->fdTempRoots.get(), ltRead, true);
     }
 
-    /* Upgrade the lock to a write lock.  This will cause us to block
-       if the garbage collector is holding our lock. */
-    debug(format("acquiring write lock on '%1%'") % fnTempRoots);
-    lockFile(state->fdTempRoots.get(), ltWrite, true);
+    /* If no garbage collector is running, the next one will find the
+       new root in our temporary roots file. Any connection we have
+       is to a collector that has exited. */
+    if (openGCLock(ltRead, false)) {
+        _state.lock()->fdRootsSocket = -1;
+        return;
+    }
 
-    string s = printStorePath(path) + '\0';
-    writeFull(state->fdTempRoots.get(), s);
+    /* Otherwise the collector may already have read that file, so
+       tell it about the root directly, reusing our connection if we
+       have one. If that's not possible, wait until it has finished. */
+    if (!sendTempRoot(printStorePath(path)))
+        syncWithGC();
+}
+
+
+bool LocalStore::sendTempRoot(const Path & path)
+{
+    auto state(_state.lock());
+
+    /* A cached connection may belong to a previous collector, so
+       reconnect once if it turns out to be broken. */
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        if (!state->fdRootsSocket) {
+            state->fdRootsSocket = connectToGC(stateDir + "/" + gcSocketPath);
+            if (!state->fdRootsSocket) return false;
+        }
+        if (sendRootToGC(state->fdRootsSocket.get(), path)) return true;
+        state->fdRootsSocket = -1;
+    }
 
-    /* Downgrade to a read lock. */
-    debug(format("downgrading to read lock on '%1%'") % fnTempRoots);
-    lockFile(state->fdTempRoots.get(), ltRead, true);
+    return false;
 }
 
 
@@ -468,6 +550,26 @@ struct LocalStore::GCState
     uint64_t bytesInvalidated;
     bool moveToTrash = true;
     bool shouldDelete;
+    /* If set, the paths reachable from the roots, as computed by
+       findReachable(). */
+    std::optional<StorePathSet> reachable;
+
+    /* Temporary roots that other processes registered through the
+       GC socket after the roots were read. 'pending' holds roots that
+       have not been processed by isNewlyRooted() yet, 'alive' the
+       closures of the processed ones. */
+    struct Shared
+    {
+        StorePathSet pending;
+        StorePathSet alive;
+    };
+    Sync<Shared> shared;
+
+    /* Held by the collector while it deletes a path, and by the
+       server while it registers a new root, so that a root can't
+       appear halfway through a deletion. */
+    std::mutex deleting;
+
     GCState(const GCOptions & options, GCResults & results)
         : options(options), results(results), bytesInvalidated(0) { }
 };
@@ -481,6 +583,34 @@ bool LocalStore::isActiveTempFile(const GCState & state,
 }
 
 
+bool LocalStore::isNewlyRooted(GCState & state, const Path & path)
+{
+    auto shared(state.shared.lock());
+
+    for (auto & root : shared->pending) {
+        shared->alive.insert(root);
+        if (isValidPath(root)) {
+            StorePathSet closure;
+            computeFSClosure(root, closure);
+            shared->alive.insert(closure.begin(), closure.end());
+        }
+    }
+    shared->pending.clear();
+
+    if (shared->alive.empty()) return false;
+
+    /* Like isActiveTempFile(), also keep the lock files and build
+       directories of new roots. */
+    for (auto suffix : {"", ".lock", ".chroot", ".check"}) {
+        if (!hasSuffix(path, suffix)) continue;
+        auto storePath = maybeParseStorePath(string(path, 0, path.size() - strlen(suffix)));
+        if (storePath && shared->alive.count(*storePath)) return true;
+    }
+
+    return false;
+}
+
+
 void LocalStore::deleteGarbage(GCState & state, const Path & path)
 {
     uint64_t bytesFreed;
@@ -496,11 +626,26 @@ void LocalStore::deletePathRecursive(GCState & state, const Path & path)
     uint64_t size = 0;
 
     auto storePath = maybeParseStorePath(path);
-    if (storePath && isValidPath(*storePath)) {
+    bool valid = storePath && isValidPath(*storePath);
+    if (valid) {
         StorePathSet referrers;
         queryReferrers(*storePath, referrers);
         for (auto & i : referrers)
             if (printStorePath(i) != path) deletePathRecursive(state, printStorePath(i));
+    }
+
+    std::unique_lock<std::mutex> deleting(state.deleting);
+
+    if (isNewlyRooted(state, path)) {
+        debug("cannot delete '%s' because it has become a temporary root", path);
+        if (storePath) {
+            state.dead.erase(*storePath);
+            state.alive.insert(*storePath);
+        }
+        return;
+    }
+
+    if (valid) {
         size = queryPathInfo(*storePath)->narSize;
         invalidatePathChecked(*storePath);
     }
@@ -565,6 +710,12 @@ bool LocalStore::canReachRoot(GCState & state, StorePathSet & visited, const Sto
 
     visited.insert(path);
 
+    if (state.reachable) {
+        if (!state.reachable->count(path)) return false;
+        state.alive.insert(path);
+        return true;
+    }
+
     if (!isValidPath(path)) return false;
 
     StorePathSet incoming;
@@ -602,6 +753,106 @@ bool LocalStore::canReachRoot(GCState & state, StorePathSet & visited, const Sto
 }
 
 
+/* Compute the set of paths reachable from the roots, following the
+   edges that canReachRoot() follows backwards. The reference graph
+   is read from the database in one go rather than queried path by
+   path, so this is linear in the size of the store. */
+StorePathSet LocalStore::findReachable(const GCState & state)
+{
+    struct Node
+    {
+        std::string path;
+        std::optional<std::string> deriver;
+        std::vector<uint64_t> references;
+        std::vector<uint64_t> outputs;
+    };
+
+    std::unordered_map<uint64_t, Node> nodes;
+    std::unordered_map<std::string, uint64_t> ids;
+
+    retrySQLite<void>([&]() {
+        auto st(_state.lock());
+
+        nodes.clear();
+        ids.clear();
+
+        SQLiteStmt queryPaths(st->db, "select id, path, deriver from ValidPaths");
+        auto useQueryPaths(queryPaths.use());
+        while (useQueryPaths.next()) {
+            auto id = useQueryPaths.getInt(0);
+            auto & node = nodes[id];
+            node.path = useQueryPaths.getStr(1);
+            if (!useQueryPaths.isNull(2))
+                node.deriver = useQueryPaths.getStr(2);
+            ids.emplace(node.path, id);
+        }
+
+        SQLiteStmt queryRefs(st->db, "select referrer, reference from Refs");
+        auto useQueryRefs(queryRefs.use());
+        while (useQueryRefs.next()) {
+            auto i = nodes.find(useQueryRefs.getInt(0));
+            if (i != nodes.end())
+                i->second.references.push_back(useQueryRefs.getInt(1));
+        }
+
+        if (state.gcKeepOutputs) {
+            SQLiteStmt queryOutputs(st->db,
+                "select d.drv, v.id from DerivationOutputs d join ValidPaths v on d.path = v.path");
+            auto useQueryOutputs(queryOutputs.use());
+            while (useQueryOutputs.next()) {
+                auto i = nodes.find(useQueryOutputs.getInt(0));
+                if (i != nodes.end())
+                    i->second.outputs.push_back(useQueryOutputs.getInt(1));
+            }
+        }
+    });
+
+    StorePathSet reachable;
+    std::unordered_set<uint64_t> marked;
+    std::vector<uint64_t> todo;
+
+    auto mark = [&](uint64_t id) {
+        if (marked.insert(id).second) todo.push_back(id);
+    };
+
+    for (auto & root : state.roots) {
+        reachable.insert(root);
+        auto i = ids.find(printStorePath(root));
+        if (i != ids.end()) mark(i->second);
+    }
+
+    while (!todo.empty()) {
+        checkInterrupt();
+
+        auto id = todo.back();
+        todo.pop_back();
+
+        auto i = nodes.find(id);
+        if (i == nodes.end()) continue;
+        auto & node(i->second);
+
+        reachable.insert(parseStorePath(node.path));
+
+        for (auto & ref : node.references)
+            mark(ref);
+
+        /* Keep the derivers of live paths. This is slightly more
+           conservative than canReachRoot(), which also checks that
+           the path is an output of the deriver. */
+        if (state.gcKeepDerivations && node.deriver) {
+            auto j = ids.find(*node.deriver);
+            if (j != ids.end()) mark(j->second);
+        }
+
+        /* Keep the outputs of live derivations. */
+        for (auto & output : node.outputs)
+            mark(output);
+    }
+
+    return reachable;
+}
+
+
 void LocalStore::tryToDelete(GCState & state, const Path & path)
 {
     checkInterrupt();
@@ -715,6 +966,101 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
        b) Processes from creating new temporary root files. */
     AutoCloseFD fdGCLock = openGCLock(ltWrite);
 
+    /* Start a server that accepts new temporary roots from other
+       processes (see addTempRoot()). This allows us to release the
+       temporary roots files once they have been read, so that
+       builds don't block until we're done. */
+    Path socketPath = stateDir + "/" + gcSocketPath;
+    AutoCloseFD fdServer;
+    try {
+        createDirs(dirOf(socketPath));
+        fdServer = createUnixDomainSocket(socketPath, 0666);
+    } catch (Error & e) {
+        printInfo("note: cannot create garbage collector socket: %s", e.msg());
+    }
+
+    /* The threads serving the clients' connections, indexed by
+       their file descriptors. Each thread removes itself when its
+       client disconnects. */
+    Sync<std::map<int, std::thread>> connections;
+    std::condition_variable connectionClosed;
+    Pipe shutdownPipe;
+    shutdownPipe.create();
+    std::thread serverThread;
+
+    auto handleConnection = [&](AutoCloseFD fd) {
+        try {
+            while (true) {
+                auto path = readLine(fd.get());
+                auto storePath = parseStorePath(path);
+                debug("got new temporary root '%s'", path);
+                {
+                    std::lock_guard<std::mutex> deleting(state.deleting);
+                    state.shared.lock()->pending.insert(storePath);
+                }
+                writeFull(fd.get(), "1", false);
+            }
+        } catch (EndOfFile &) {
+        } catch (Error & e) {
+            debug("reading temporary root from garbage collector client: %s", e.msg());
+        } catch (...) {
+            /* E.g. Interrupted, which isn't an Error. */
+        }
+
+        auto conns(connections.lock());
+        auto i = conns->find(fd.get());
+        assert(i != conns->end());
+        i->second.detach();
+        conns->erase(i);
+        connectionClosed.notify_all();
+    };
+
+    if (fdServer)
+        serverThread = std::thread([&]() {
+            while (true) {
+                std::vector<struct pollfd> fds(2);
+                fds[0].fd = shutdownPipe.readSide.get();
+                fds[0].events = POLLIN;
+                fds[1].fd = fdServer.get();
+                fds[1].events = POLLIN;
+                if (poll(fds.data(), fds.size(), -1) == -1) {
+                    if (errno == EINTR) continue;
+                    printError("polling the garbage collector socket: %s", strerror(errno));
+                    break;
+                }
+                if (fds[0].revents) break;
+                if (fds[1].revents) {
+                    AutoCloseFD fdClient = accept(fdServer.get(), nullptr, nullptr);
+                    if (!fdClient) {
+                        if (errno == EINTR || errno == ECONNABORTED) continue;
+                        printError("accepting a garbage collector client: %s", strerror(errno));
+                        break;
+                    }
+                    closeOnExec(fdClient.get());
+                    auto fd = fdClient.get();
+                    auto conns(connections.lock());
+                    conns->emplace(fd, std::thread(handleConnection, std::move(fdClient)));
+                }
+            }
+            /* Make new clients fall back to waiting for the GC
+               lock. */
+            unlink(socketPath.c_str());
+            fdServer = -1;
+        });
+
+    auto stopServer = [&]() {
+        if (!serverThread.joinable()) return;
+        writeFull(shutdownPipe.writeSide.get(), "x", false);
+        serverThread.join();
+        auto conns(connections.lock());
+        for (auto & conn : *conns)
+            shutdown(conn.first, SHUT_RDWR);
+        while (!conns->empty())
+            conns.wait(connectionClosed);
+    };
+
+    Finally cleanup(stopServer);
+
     /* Find the roots.  Since we've grabbed the GC lock, the set of
        permanent roots cannot increase now. */
     printInfo("finding garbage collector roots...");
@@ -735,6 +1081,10 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         state.roots.insert(root.first);
     }
 
+    /* If other processes can send us new roots, we no longer need
+       to keep them from writing to their temporary roots files. */
+    if (fdServer) fds.clear();
+
     /* After this point the set of roots or temporary roots cannot
        increase, since we hold locks on everything.  So everything
        that is not reachable from `roots' is garbage. */
@@ -773,6 +1123,11 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
         else
             printInfo("determining live/dead paths...");
 
+        /* Determine the live paths up front, rather than searching
+           for a root from every path. */
+        printInfo("marking live paths...");
+        state.reachable = findReachable(state);
+
         try {
 
             AutoCloseDir dir(opendir(realStoreDir.c_str()));
@@ -829,6 +1184,7 @@ void LocalStore::collectGarbage(const GCOptions & options, GCResults & results)
     }
 
     /* Allow other processes to add to the store from here on. */
+    stopServer();
     fdGCLock = -1;
     fds.clear();
 
@@ -248,6 +248,18 @@ LocalStore::LocalStore(const Params & params)
     state->stmtQueryPathFromHashPart.create(state->db,
         "select path from ValidPaths where path >= ? limit 1;");
     state->stmtQueryValidPaths.create(state->db, "select path from ValidPaths");
+    state->stmtQueryClosure.create(state->db,
+        "with recursive Closure(id) as ("
+        "  select id from ValidPaths where path = ?"
+        "  union"
+        "  select reference from Refs join Closure on referrer = Closure.id"
+        ") select path from ValidPaths where id in (select id from Closure);");
+    state->stmtQueryReverseClosure.create(state->db,
+        "with recursive Closure(id) as ("
+        "  select id from ValidPaths where path = ?"
+        "  union"
+        "  select referrer from Refs join Closure on reference = Closure.id"
+        ") select path from ValidPaths where id in (select id from Closure);");
 }
 
 
@@ -783,6 +795,42 @@ void LocalStore::queryReferrers(const StorePath & path, StorePathSet & referrers
 }
 
 
+void LocalStore::computeFSClosure(const StorePathSet & startPaths,
+    StorePathSet & out, bool flipDirection, bool includeOutputs, bool includeDerivers)
+{
+    /* The generic implementation treats paths already in 'out' as
+       visited, and handles outputs and derivers. */
+    if (!out.empty() || includeOutputs || includeDerivers)
+        return Store::computeFSClosure(startPaths, out, flipDirection, includeOutputs, includeDerivers);
+
+    retrySQLite<void>([&]() {
+        auto state(_state.lock());
+
+        StorePathSet closure;
+
+        for (auto & startPath : startPaths) {
+            /* The closure of a path that has already been reached is
+               a subset of what we have. */
+            if (closure.count(startPath)) continue;
+
+            auto useQueryClosure((flipDirection ? state->stmtQueryReverseClosure : state->stmtQueryClosure)
+                .use()(printStorePath(startPath)));
+
+            bool found = false;
+            while (useQueryClosure.next()) {
+                closure.insert(parseStorePath(useQueryClosure.getStr(0)));
+                found = true;
+            }
+
+            if (!found)
+                throw InvalidPath("path '%s' is not valid", printStorePath(startPath));
+        }
+
+        out = std::move(closure);
+    });
+}
+
+
 StorePathSet LocalStore::queryValidDerivers(const StorePath & path)
 {
     return retrySQLite<StorePathSet>([&]() {
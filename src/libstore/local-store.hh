@@ -68,10 +68,16 @@ private:
         SQLiteStmt stmtQueryDerivationOutputs;
         SQLiteStmt stmtQueryPathFromHashPart;
         SQLiteStmt stmtQueryValidPaths;
+        SQLiteStmt stmtQueryClosure;
+        SQLiteStmt stmtQueryReverseClosure;
 
         /* The file to which we write our temporary roots. */
         AutoCloseFD fdTempRoots;
 
+        /* Connection to the socket of a running garbage collector,
+           through which we send it new temporary roots. */
+        AutoCloseFD fdRootsSocket;
+
         /* The last time we checked whether to do an auto-GC, or an
            auto-GC finished. */
         std::chrono::time_point<std::chrono::steady_clock> lastGCCheck;
@@ -136,6 +142,14 @@ public:
 
     void queryReferrers(const StorePath & path, StorePathSet & referrers) override;
 
+    using Store::computeFSClosure;
+
+    /* Compute plain closures with a single recursive query per start
+       path rather than one query per path in the closure. */
+    void computeFSClosure(const StorePathSet & paths,
+        StorePathSet & out, bool flipDirection = false,
+        bool includeOutputs = false, bool includeDerivers = false) override;
+
     StorePathSet queryValidDerivers(const StorePath & path) override;
 
     std::map<std::string, std::optional<StorePath>> queryPartialDerivationOutputMap(const StorePath & path) override;
@@ -254,12 +268,23 @@ private:
 
     bool canReachRoot(GCState & state, StorePathSet & visited, const StorePath & path);
 
+    StorePathSet findReachable(const GCState & state);
+
     void deletePathRecursive(GCState & state, const Path & path);
 
     bool isActiveTempFile(const GCState & state,
         const Path & path, const string & suffix);
 
-    AutoCloseFD openGCLock(LockType lockType);
+    bool isNewlyRooted(GCState & state, const Path & path);
+
+    /* Acquire the global GC lock. If 'wait' is false and the lock is
+       held by someone else, return a closed file descriptor. */
+    AutoCloseFD openGCLock(LockType lockType, bool wait = true);
+
+    /* Send a temporary root to a running garbage collector over the
+       connection in 'State', opening it if necessary. Return false if
+       the collector cannot be reached. */
+    bool sendTempRoot(const Path & path);
 
     void findRoots(const Path & path, unsigned char type, Roots & roots);
 
@@ -3,6 +3,7 @@
 #include "util.hh"
 #include "archive.hh"
 
+#include <array>
 #include <map>
 #include <cstdlib>
 
@@ -13,42 +14,60 @@ namespace nix {
 static unsigned int refLength = 32; /* characters */
 
 
+/* The hash parts still being looked for. The transparent comparator
+   allows looking up candidates without copying them into a string. */
+typedef std::set<std::string, std::less<>> RefSet;
+
+
 static void search(const unsigned char * s, size_t len,
-    StringSet & hashes, StringSet & seen)
+    RefSet & hashes, StringSet & seen)
 {
-    static bool initialised = false;
-    static bool isBase32[256];
-    if (!initialised) {
-        for (unsigned int i = 0; i < 256; ++i) isBase32[i] = false;
+    static const auto isBase32 = []() {
+        std::array<bool, 256> isBase32{};
         for (unsigned int i = 0; i < base32Chars.size(); ++i)
             isBase32[(unsigned char) base32Chars[i]] = true;
-        initialised = true;
-    }
+        return isBase32;
+    }();
+
+    if (hashes.empty()) return;
 
     for (size_t i = 0; i + refLength <= len; ) {
+        /* Check the window from the end, so that a non-base32
+           character lets us skip everything up to and including
+           it. */
         int j;
-        bool match = true;
         for (j = refLength - 1; j >= 0; --j)
-            if (!isBase32[(unsigned char) s[i + j]]) {
-                i += j + 1;
-                match = false;
-                break;
+            if (!isBase32[s[i + j]]) break;
+        if (j >= 0) {
+            i += j + 1;
+            continue;
+        }
+
+        /* Slide through the rest of this run of base32 characters.
+           Each step only needs to classify the character entering
+           the window. */
+        while (true) {
+            auto ref = hashes.find(std::string_view((const char *) s + i, refLength));
+            if (ref != hashes.end()) {
+                debug("found reference to '%1%' at offset '%2%'", *ref, i);
+                seen.insert(*ref);
+                hashes.erase(ref);
+                if (hashes.empty()) return;
             }
-        if (!match) continue;
-        string ref((const char *) s + i, refLength);
-        if (hashes.erase(ref)) {
-            debug(format("found reference to '%1%' at offset '%2%'")
-                  % ref % i);
-            seen.insert(ref);
+            if (i + refLength >= len || !isBase32[s[i + refLength]]) break;
+            ++i;
         }
-        ++i;
+
+        /* The character after the window is not base32, so no window
+           containing it can match. */
+        i += refLength + 1;
     }
 }
 
 
 struct RefScanSink : Sink
 {
-    StringSet hashes;
+    RefSet hashes;
     StringSet seen;
 
     string tail;
@@ -61,6 +80,10 @@ struct RefScanSink : Sink
 
 void RefScanSink::operator () (const unsigned char * data, size_t len)
 {
+    /* Once every reference has been found, there is nothing left to
+       look for in the rest of the input. */
+    if (hashes.empty()) return;
+
     /* It's possible that a reference spans the previous and current
        fragment, so search in the concatenation of the tail of the
        previous fragment and the start of the current fragment. */
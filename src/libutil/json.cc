@@ -8,14 +8,21 @@ namespace nix {
 void toJSON(std::ostream & str, const char * start, const char * end)
 {
     str << '"';
-    for (auto i = start; i != end; i++)
-        if (*i == '\"' || *i == '\\') str << '\\' << *i;
-        else if (*i == '\n') str << "\\n";
-        else if (*i == '\r') str << "\\r";
-        else if (*i == '\t') str << "\\t";
-        else if (*i >= 0 && *i < 32)
-            str << "\\u" << std::setfill('0') << std::setw(4) << std::hex << (uint16_t) *i << std::dec;
-        else str << *i;
+    for (auto i = start; i != end; ) {
+        /* Write runs of characters that don't need escaping in one
+           go. */
+        auto j = i;
+        while (j != end && *j != '\"' && *j != '\\' && !(*j >= 0 && *j < 32)) j++;
+        str.write(i, j - i);
+        if (j == end) break;
+        if (*j == '\"' || *j == '\\') str << '\\' << *j;
+        else if (*j == '\n') str << "\\n";
+        else if (*j == '\r') str << "\\r";
+        else if (*j == '\t') str << "\\t";
+        else
+            str << "\\u" << std::setfill('0') << std::setw(4) << std::hex << (uint16_t) *j << std::dec;
+        i = j + 1;
+    }
     str << '"';
 }
 
@@ -2,6 +2,8 @@
 #include "common-eval-args.hh"
 #include "derivations.hh"
 #include "eval.hh"
+#include "eval-inline.hh"
+#include "eval-workers.hh"
 #include "get-drvs.hh"
 #include "globals.hh"
 #include "names.hh"
@@ -13,6 +15,7 @@
 #include "util.hh"
 #include "json.hh"
 #include "value-to-json.hh"
+#include "json-to-value.hh"
 #include "xml-writer.hh"
 #include "../nix/legacy.hh"
 
@@ -60,6 +63,10 @@ struct Globals
     bool removeAll;
     string forceName;
     bool prebuiltOnly;
+
+    /* Replace 'state' and 'instSource.autoArgs' by a fresh evaluator
+       with its own store connection (for use in worker processes). */
+    std::function<void()> resetState;
 };
 
 
@@ -778,9 +785,15 @@ static bool cmpElemByName(const DrvInfo & a, const DrvInfo & b)
 {
     auto a_name = a.queryName();
     auto b_name = b.queryName();
-    return lexicographical_compare(
-        a_name.begin(), a_name.end(),
-        b_name.begin(), b_name.end(), cmpChars);
+    if (lexicographical_compare(
+            a_name.begin(), a_name.end(),
+            b_name.begin(), b_name.end(), cmpChars))
+        return true;
+    if (lexicographical_compare(
+            b_name.begin(), b_name.end(),
+            a_name.begin(), a_name.end(), cmpChars))
+        return false;
+    return a.attrPath < b.attrPath;
 }
 
 
@@ -891,6 +904,157 @@ static void queryJSON(Globals & globals, vector<DrvInfo> & elems)
 }
 
 
+/* Like loadDerivations() followed by queryJSON(), but evaluate the
+   top-level attributes of the expression in 'eval-workers' worker
+   processes. Each worker returns the JSON for the derivations under
+   the attributes assigned to it; the parent merges them in attribute
+   order and sorts them. Returns false if the expression can't be
+   split up. */
+static bool queryJSONParallel(Globals & globals, const string & attrPath)
+{
+    struct Elem
+    {
+        string attrPath, name, system, meta;
+    };
+
+    auto & state(*globals.state);
+
+    Value vRoot, vTop;
+    loadSourceExpr(state, globals.instSource.nixExprPath, vRoot);
+    Value & v(*findAlongAttrPath(state, attrPath, *globals.instSource.autoArgs, vRoot).first);
+    state.autoCallFunction(*globals.instSource.autoArgs, v, vTop);
+
+    auto roots = getDerivationRoots(state, vTop);
+    if (roots.empty()) return false;
+
+    std::map<string, vector<Elem>> results;
+
+    runEvalWorkers(evalSettings.evalWorkers, roots,
+        [&]() -> EvalWorkerFun {
+            globals.resetState();
+            auto & state(*globals.state);
+            auto & autoArgs(*globals.instSource.autoArgs);
+
+            Value vRoot;
+            loadSourceExpr(state, globals.instSource.nixExprPath, vRoot);
+            Value & v(*findAlongAttrPath(state, attrPath, autoArgs, vRoot).first);
+            auto vTop = allocRootValue(state.allocValue());
+            state.autoCallFunction(autoArgs, v, **vTop);
+
+            return [&globals, &state, &autoArgs, attrPath, vTop](const std::string & root) {
+                DrvInfos drvs;
+                getDerivationsFromRoot(state, **vTop, root, attrPath, autoArgs, drvs, true);
+
+                auto & systemFilter(globals.instSource.systemFilter);
+
+                Strings res;
+                for (auto & i : drvs) {
+                    if (systemFilter != "*" && i.querySystem() != systemFilter) continue;
+                    res.push_back(i.attrPath);
+                    res.push_back(i.queryName());
+                    res.push_back(i.querySystem());
+                    std::ostringstream meta;
+                    {
+                        JSONObject metaObj(meta);
+                        for (auto & j : i.queryMetaNames()) {
+                            auto placeholder = metaObj.placeholder(j);
+                            Value * v = i.queryMeta(j);
+                            if (!v) {
+                                logError({
+                                    .name = "Invalid meta attribute",
+                                    .hint = hintfmt("derivation '%s' has invalid meta attribute '%s'",
+                                        i.queryName(), j)
+                                });
+                                placeholder.write(nullptr);
+                            } else {
+                                PathSet context;
+                                printValueAsJSON(state, true, *v, placeholder, context);
+                            }
+                        }
+                    }
+                    res.push_back(meta.str());
+                }
+
+                StringSink sink;
+                sink << res;
+                return *sink.s;
+            };
+        },
+        [&](const std::string & root, const std::string & result) {
+            StringSource source(result);
+            auto res = readStrings<Strings>(source);
+            auto & elems(results[root]);
+            for (auto i = res.begin(); i != res.end(); ) {
+                Elem elem;
+                elem.attrPath = *i++;
+                elem.name = *i++;
+                elem.system = *i++;
+                elem.meta = *i++;
+                elems.push_back(std::move(elem));
+            }
+        });
+
+    /* Merge the results in the order in which a serial traversal
+       would have visited them. Workers don't share the 'done' set of
+       getDerivations(), so a derivation reachable from several
+       top-level attributes is returned once for each of them. Drop
+       these aliases as that set would, by the identity of the
+       attribute set, keeping the first one. Aliases necessarily agree
+       on their name, system and meta attributes, so only elements
+       that do are looked up in our own evaluator. */
+    std::map<std::tuple<string, string, string>, size_t> similar;
+    for (auto & root : roots)
+        for (auto & elem : results[root])
+            similar[{elem.name, elem.system, elem.meta}]++;
+
+    vector<Elem> elems;
+    std::set<Bindings *> done;
+    for (auto & root : roots)
+        for (auto & elem : results[root]) {
+            if (similar[{elem.name, elem.system, elem.meta}] > 1) {
+                auto relPath = attrPath.empty() ? elem.attrPath : string(elem.attrPath, attrPath.size() + 1);
+                Value & vElem(*findAlongAttrPath(state, relPath, *globals.instSource.autoArgs, vTop).first);
+                state.forceValue(vElem);
+                if (vElem.type == tAttrs && !done.insert(vElem.attrs).second) continue;
+            }
+            elems.push_back(std::move(elem));
+        }
+
+    stable_sort(elems.begin(), elems.end(), [](const Elem & a, const Elem & b) {
+        if (lexicographical_compare(
+                a.name.begin(), a.name.end(),
+                b.name.begin(), b.name.end(), cmpChars))
+            return true;
+        if (lexicographical_compare(
+                b.name.begin(), b.name.end(),
+                a.name.begin(), a.name.end(), cmpChars))
+            return false;
+        return a.attrPath < b.attrPath;
+    });
+
+    JSONObject topObj(cout, true);
+    for (auto & i : elems) {
+        JSONObject pkgObj = topObj.object(i.attrPath);
+
+        auto drvName = DrvName(i.name);
+        pkgObj.attr("name", drvName.fullName);
+        pkgObj.attr("pname", drvName.name);
+        pkgObj.attr("version", drvName.version);
+        pkgObj.attr("system", i.system);
+
+        /* Round-trip the meta attributes through the evaluator so
+           they're formatted in the same way as by queryJSON(). */
+        Value vMeta;
+        parseJSON(state, i.meta, vMeta);
+        auto placeholder = pkgObj.placeholder("meta");
+        PathSet context;
+        printValueAsJSON(state, true, vMeta, placeholder, context);
+    }
+
+    return true;
+}
+
+
 static void opQuery(Globals & globals, Strings opFlags, Strings opArgs)
 {
     Strings remaining;
@@ -936,6 +1100,16 @@ static void opQuery(Globals & globals, Strings opFlags, Strings opArgs)
     if (printAttrPath && source != sAvailable)
         throw UsageError("--attr-path(-P) only works with --available");
 
+    if (evalSettings.evalWorkers > 1
+        && source == sAvailable
+        && jsonOutput
+        && !compareVersions
+        && !printStatus
+        && !globals.prebuiltOnly
+        && (opArgs.empty() || opArgs == Strings{"*"})
+        && queryJSONParallel(globals, attrPath))
+        return;
+
     /* Obtain derivation information from the specified source. */
     DrvInfos availElems, installedElems;
 
@@ -1445,6 +1619,12 @@ static int main_nix_env(int argc, char * * argv)
 
         globals.instSource.autoArgs = myArgs.getAutoArgs(*globals.state);
 
+        globals.resetState = [&]() {
+            globals.state = std::shared_ptr<EvalState>(new EvalState(myArgs.searchPath, openStore()));
+            globals.state->repair = repair;
+            globals.instSource.autoArgs = myArgs.getAutoArgs(*globals.state);
+        };
+
         if (globals.profile == "")
             globals.profile = getEnv("NIX_PROFILE").value_or("");
 
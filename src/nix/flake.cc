@@ -12,6 +12,7 @@
 #include "registry.hh"
 #include "json.hh"
 #include "eval-cache.hh"
+#include "eval-workers.hh"
 
 #include <nlohmann/json.hpp>
 #include <queue>
@@ -319,14 +320,14 @@ struct CmdFlakeCheck : FlakeCommand
             }
         };
 
-        auto checkNixOSConfiguration = [&](const std::string & attrPath, Value & v, const Pos & pos) {
+        auto checkNixOSConfiguration = [&](EvalState & state, const std::string & attrPath, Value & v, const Pos & pos) {
             try {
                 Activity act(*logger, lvlChatty, actUnknown,
                     fmt("checking NixOS configuration '%s'", attrPath));
-                Bindings & bindings(*state->allocBindings(0));
-                auto vToplevel = findAlongAttrPath(*state, "config.system.build.toplevel", bindings, v).first;
-                state->forceAttrs(*vToplevel, pos);
-                if (!state->isDerivation(*vToplevel))
+                Bindings & bindings(*state.allocBindings(0));
+                auto vToplevel = findAlongAttrPath(state, "config.system.build.toplevel", bindings, v).first;
+                state.forceAttrs(*vToplevel, pos);
+                if (!state.isDerivation(*vToplevel))
                     throw Error("attribute 'config.system.build.toplevel' is not a derivation");
             } catch (Error & e) {
                 e.addTrace(pos, hintfmt("while checking the NixOS configuration '%s'", attrPath));
@@ -383,6 +384,40 @@ struct CmdFlakeCheck : FlakeCommand
             }
         };
 
+        /* NixOS configurations are independent and expensive to
+           evaluate, so with 'eval-workers' > 1 they are checked in
+           worker processes. Each worker has its own evaluator and store
+           connection, and evaluates the flake from scratch. */
+        auto checkNixOSConfigurationsParallel = [&](Value & vConfigs) {
+            Strings names;
+            for (auto & attr : *vConfigs.attrs)
+                names.push_back(attr.name);
+
+            runEvalWorkers(evalSettings.evalWorkers, names,
+                [&]() -> EvalWorkerFun {
+                    auto state2 = std::make_shared<EvalState>(searchPath, createStore());
+                    auto vFlake2 = state2->allocValue();
+                    flake::callFlake(*state2, flake, *vFlake2);
+                    state2->forceAttrs(*vFlake2);
+                    auto aOutputs = vFlake2->attrs->get(state2->symbols.create("outputs"));
+                    assert(aOutputs);
+                    state2->forceAttrs(*aOutputs->value);
+                    auto aConfigs = aOutputs->value->attrs->get(state2->symbols.create("nixosConfigurations"));
+                    assert(aConfigs);
+                    state2->forceAttrs(*aConfigs->value, *aConfigs->pos);
+                    auto vConfigs2 = allocRootValue(aConfigs->value);
+
+                    return [&, state2, vConfigs2](const std::string & name) {
+                        auto attr = (*vConfigs2)->attrs->get(state2->symbols.create(name));
+                        assert(attr);
+                        checkNixOSConfiguration(*state2, fmt("nixosConfigurations.%s", name),
+                            *attr->value, *attr->pos);
+                        return std::string();
+                    };
+                },
+                [&](const std::string & name, const std::string & result) { });
+        };
+
         {
             Activity act(*logger, lvlInfo, actUnknown, "evaluating flake");
 
@@ -487,9 +522,12 @@ struct CmdFlakeCheck : FlakeCommand
 
                         else if (name == "nixosConfigurations") {
                             state->forceAttrs(vOutput, pos);
-                            for (auto & attr : *vOutput.attrs)
-                                checkNixOSConfiguration(fmt("%s.%s", name, attr.name),
-                                    *attr.value, *attr.pos);
+                            if (evalSettings.evalWorkers > 1 && vOutput.attrs->size() > 1)
+                                checkNixOSConfigurationsParallel(vOutput);
+                            else
+                                for (auto & attr : *vOutput.attrs)
+                                    checkNixOSConfiguration(*state, fmt("%s.%s", name, attr.name),
+                                        *attr.value, *attr.pos);
                         }
 
                         else if (name == "hydraJobs")
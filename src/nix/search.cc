@@ -9,10 +9,15 @@
 #include "shared.hh"
 #include "eval-cache.hh"
 #include "attr-path.hh"
+#include "installables.hh"
+#include "flake/flake.hh"
+#include "hash.hh"
 
 #include <regex>
 #include <fstream>
 
+#include <nlohmann/json.hpp>
+
 using namespace nix;
 
 std::string wrap(std::string prefix, std::string s)
@@ -30,6 +35,62 @@ std::string hilite(const std::string & s, const std::smatch & m, std::string pos
           + std::string(m.suffix());
 }
 
+struct SearchEntry
+{
+    std::string attrPath;
+    std::string pname;
+    std::string version;
+    std::string description;
+};
+
+/* Bump this whenever the contents of the search index change. */
+static const unsigned int searchIndexVersion = 1;
+
+static Path getSearchIndexPath(const flake::Fingerprint & fingerprint, const std::vector<std::string> & attrPaths)
+{
+    auto key = fmt("%d;%s;%s", searchIndexVersion, fingerprint.to_string(Base16, false), concatStringsSep(";", attrPaths));
+    return getCacheDir() + "/nix/search-index/" + hashString(htSHA256, key).to_string(Base32, false) + ".json";
+}
+
+static std::optional<std::vector<SearchEntry>> readSearchIndex(const Path & path)
+{
+    if (!pathExists(path)) return std::nullopt;
+
+    try {
+        std::vector<SearchEntry> entries;
+        for (auto & i : nlohmann::json::parse(readFile(path)))
+            entries.push_back(SearchEntry {
+                .attrPath = i.at(0),
+                .pname = i.at(1),
+                .version = i.at(2),
+                .description = i.at(3),
+            });
+        return entries;
+    } catch (std::exception & e) {
+        debug("ignoring invalid search index '%s': %s", path, e.what());
+        return std::nullopt;
+    }
+}
+
+static void writeSearchIndex(const Path & path, const std::vector<SearchEntry> & entries)
+{
+    auto json = nlohmann::json::array();
+    for (auto & entry : entries)
+        json.push_back({ entry.attrPath, entry.pname, entry.version, entry.description });
+
+    try {
+        createDirs(dirOf(path));
+        auto tmpPath = fmt("%s.tmp-%d", path, getpid());
+        writeFile(tmpPath, json.dump());
+        if (rename(tmpPath.c_str(), path.c_str()) == -1)
+            throw SysError("renaming '%s' to '%s'", tmpPath, path);
+    } catch (std::exception & e) {
+        /* E.g. json.dump() throws on descriptions that aren't valid
+           UTF-8. */
+        debug("cannot write search index '%s': %s", path, e.what());
+    }
+}
+
 struct CmdSearch : InstallableCommand, MixJSON
 {
     std::vector<std::string> res;
@@ -96,6 +157,65 @@ struct CmdSearch : InstallableCommand, MixJSON
 
         uint64_t results = 0;
 
+        auto match = [&](const SearchEntry & entry)
+        {
+            size_t found = 0;
+
+            std::smatch attrPathMatch;
+            std::smatch descriptionMatch;
+            std::smatch nameMatch;
+
+            for (auto & regex : regexes) {
+                std::regex_search(entry.attrPath, attrPathMatch, regex);
+                std::regex_search(entry.pname, nameMatch, regex);
+                std::regex_search(entry.description, descriptionMatch, regex);
+                if (!attrPathMatch.empty()
+                    || !nameMatch.empty()
+                    || !descriptionMatch.empty())
+                    found++;
+            }
+
+            if (found == res.size()) {
+                results++;
+                if (json) {
+                    auto jsonElem = jsonOut->object(entry.attrPath);
+                    jsonElem.attr("pname", entry.pname);
+                    jsonElem.attr("version", entry.version);
+                    jsonElem.attr("description", entry.description);
+                } else {
+                    if (results > 1) logger->cout("");
+                    logger->cout(
+                        "* %s%s",
+                        wrap("\e[0;1m", hilite(entry.attrPath, attrPathMatch, "\e[0;1m")),
+                        entry.version != "" ? " (" + entry.version + ")" : "");
+                    if (entry.description != "")
+                        logger->cout(
+                            "  %s", hilite(entry.description, descriptionMatch, ANSI_NORMAL));
+                }
+            }
+        };
+
+        /* If the flake is locked and the evaluation cache is enabled,
+           the package list is stored in a search index, so that
+           subsequent searches don't need to traverse the package set
+           again. */
+        std::optional<Path> indexPath;
+        if (auto flake = std::dynamic_pointer_cast<InstallableFlake>(installable);
+            flake && evalSettings.useEvalCache && evalSettings.pureEval)
+        {
+            auto fingerprint = flake->getLockedFlake()->getFingerprint();
+            indexPath = getSearchIndexPath(fingerprint, flake->getActualAttrPaths());
+            if (auto entries = readSearchIndex(*indexPath)) {
+                for (auto & entry : *entries)
+                    match(entry);
+                if (!json && !results)
+                    throw Error("no results for the given search term(s)!");
+                return;
+            }
+        }
+
+        std::vector<SearchEntry> entries;
+
         std::function<void(eval_cache::AttrCursor & cursor, const std::vector<Symbol> & attrPath)> visit;
 
         visit = [&](eval_cache::AttrCursor & cursor, const std::vector<Symbol> & attrPath)
@@ -114,49 +234,23 @@ struct CmdSearch : InstallableCommand, MixJSON
                 };
 
                 if (cursor.isDerivation()) {
-                    size_t found = 0;
-
                     DrvName name(cursor.getAttr("name")->getString());
 
                     auto aMeta = cursor.maybeGetAttr("meta");
                     auto aDescription = aMeta ? aMeta->maybeGetAttr("description") : nullptr;
                     auto description = aDescription ? aDescription->getString() : "";
                     std::replace(description.begin(), description.end(), '\n', ' ');
-                    auto attrPath2 = concatStringsSep(".", attrPath);
-
-                    std::smatch attrPathMatch;
-                    std::smatch descriptionMatch;
-                    std::smatch nameMatch;
-
-                    for (auto & regex : regexes) {
-                        std::regex_search(attrPath2, attrPathMatch, regex);
-                        std::regex_search(name.name, nameMatch, regex);
-                        std::regex_search(description, descriptionMatch, regex);
-                        if (!attrPathMatch.empty()
-                            || !nameMatch.empty()
-                            || !descriptionMatch.empty())
-                            found++;
-                    }
 
-                    if (found == res.size()) {
-                        results++;
-                        if (json) {
-                            auto jsonElem = jsonOut->object(attrPath2);
-                            jsonElem.attr("pname", name.name);
-                            jsonElem.attr("version", name.version);
-                            jsonElem.attr("description", description);
-                        } else {
-                            auto name2 = hilite(name.name, nameMatch, "\e[0;2m");
-                            if (results > 1) logger->cout("");
-                            logger->cout(
-                                "* %s%s",
-                                wrap("\e[0;1m", hilite(attrPath2, attrPathMatch, "\e[0;1m")),
-                                name.version != "" ? " (" + name.version + ")" : "");
-                            if (description != "")
-                                logger->cout(
-                                    "  %s", hilite(description, descriptionMatch, ANSI_NORMAL));
-                        }
-                    }
+                    SearchEntry entry {
+                        .attrPath = concatStringsSep(".", attrPath),
+                        .pname = name.name,
+                        .version = name.version,
+                        .description = description,
+                    };
+
+                    match(entry);
+
+                    if (indexPath) entries.push_back(std::move(entry));
                 }
 
                 else if (
@@ -180,6 +274,9 @@ struct CmdSearch : InstallableCommand, MixJSON
         for (auto & [cursor, prefix] : installable->getCursors(*state))
             visit(*cursor, parseAttrPath(*state, prefix));
 
+        if (indexPath)
+            writeSearchIndex(*indexPath, entries);
+
         if (!json && !results)
             throw Error("no results for the given search term(s)!");
     }
@@ -533,6 +533,32 @@ EOF
 
 (! nix flake check $flake3Dir)
 
+cat > $flake3Dir/flake.nix <<EOF
+{
+  outputs = { flake1, self }: {
+    nixosConfigurations.a.config.system.build.toplevel = { type = "derivation"; };
+    nixosConfigurations.b.config.system.build.toplevel = { type = "derivation"; };
+    nixosConfigurations.c.config.system.build.toplevel = { type = "derivation"; };
+  };
+}
+EOF
+
+nix flake check $flake3Dir
+nix flake check $flake3Dir --option eval-workers 2
+
+cat > $flake3Dir/flake.nix <<EOF
+{
+  outputs = { flake1, self }: {
+    nixosConfigurations.a.config.system.build.toplevel = { type = "derivation"; };
+    nixosConfigurations.b.config.system.build.toplevel = assert false; { type = "derivation"; };
+    nixosConfigurations.c.config.system.build.toplevel = { type = "derivation"; };
+  };
+}
+EOF
+
+(! nix flake check $flake3Dir)
+(! nix flake check $flake3Dir --option eval-workers 2)
+
 # Test 'follows' inputs.
 cat > $flake3Dir/flake.nix <<EOF
 {
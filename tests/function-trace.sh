@@ -71,3 +71,9 @@ function-trace exited (string):1:1 at
 "
 
 set -e
+
+# The profiler attributes time and allocations to call stacks.
+nix-instantiate --eval --option eval-profile-file $TEST_ROOT/profile \
+    --expr 'let f = n: builtins.length (builtins.genList (x: x) n); in f 1000'
+grep -q '^f at (string):1:[0-9]*;primop .*genList [0-9]*$' $TEST_ROOT/profile
+grep -q '^f at (string):1:[0-9]*;primop .*genList [0-9]*$' $TEST_ROOT/profile.values
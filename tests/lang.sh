@@ -68,4 +68,20 @@ for i in lang/eval-okay-*.nix; do
     fi
 done
 
+# The parse cache must yield the same results as the parser, both when
+# the cache entries are created and when they're reused.
+for i in lang/eval-okay-{attrs-large,getattrpos-functionargs,import,search-path}.nix; do
+    echo "evaluating $i with the parse cache";
+    i=$(basename $i .nix)
+    for round in 1 2; do
+        if ! NIX_PATH=lang/dir3:lang/dir4 nix-instantiate --option parse-cache true --eval --strict lang/$i.nix > lang/$i.out; then
+            echo "FAIL: $i should evaluate with the parse cache"
+            fail=1
+        elif ! diff lang/$i.out lang/$i.exp; then
+            echo "FAIL: evaluation result of $i with the parse cache not as expected"
+            fail=1
+        fi
+    done
+done
+
 exit $fail
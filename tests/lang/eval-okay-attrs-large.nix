@@ -0,0 +1,10 @@
+# Large sets get a hash index after a number of lookups; make sure
+# lookups through the index behave the same as the binary search.
+let
+  names = builtins.genList (i: "a${toString i}") 100;
+  set = builtins.listToAttrs (map (name: { inherit name; value = name; }) names);
+  found = map (name: set.${name}) names;
+  missing = builtins.filter (name: set ? ${name}) (builtins.genList (i: "b${toString i}") 100);
+in
+  [ (builtins.length found) (builtins.head found) (builtins.elemAt found 99)
+    (builtins.length missing) (set.a42 or "x") (set.b or "y") (set // { a1 = "z"; }).a1 ]
@@ -0,0 +1,16 @@
+let
+
+  strings = builtins.genericClosure {
+    startSet = [{key = "a";}];
+    operator = {key}:
+      if builtins.stringLength key >= 3
+      then []
+      else [{key = key + "a";} {key = key + "b";} {key = "a";}];
+  };
+
+  numbers = builtins.genericClosure {
+    startSet = [{key = 1;} {key = 1.0;} {key = 2.5;}];
+    operator = {key}: [{key = 2.5;} {key = 1;}];
+  };
+
+in [ (map (x: x.key) strings) (map (x: x.key) numbers) ]
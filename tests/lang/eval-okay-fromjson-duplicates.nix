@@ -0,0 +1,2 @@
+# The last occurrence of a duplicate key wins.
+builtins.fromJSON ''{"b": 1, "a": 2, "b": 3, "c": {"z": [], "y": {}, "z": true}}''
@@ -0,0 +1,4 @@
+[ (builtins.groupBy (x: if x > 2 then "big" else "small") [ 1 5 2 7 ])
+  (builtins.groupBy (x: x.name) [ { name = "b"; v = 1; } { name = "a"; v = 2; } { name = "b"; v = 3; } ])
+  (builtins.groupBy (x: x) [ ])
+]
@@ -0,0 +1,10 @@
+with builtins;
+
+let
+  xs = genList (n: n) 6;
+  drop = n: l: if n == 0 then l else drop (n - 1) (tail l);
+in
+  [ (tail xs) (drop 2 xs) (drop 4 xs) (tail (drop 4 xs))
+    (filter (x: x >= 2 && x < 5) xs) (tail (filter (x: x > 0) xs))
+    (filter (x: x != 3) xs) (drop 2 xs ++ [ 6 ]) (length (drop 3 xs))
+  ]
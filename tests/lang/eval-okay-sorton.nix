@@ -0,0 +1,6 @@
+let
+  values = builtins.sortOn (x: x.k) [ { k = 3; v = "a"; } { k = 1; v = "b"; } { k = 3; v = "c"; } { k = 2.5; v = "d"; } ];
+  strings = builtins.sortOn (s: builtins.substring 1 1 s) [ "ab" "ba" "ca" "ac" ];
+  # The elements themselves are not evaluated.
+  lazy = builtins.sortOn (x: x.k) [ { k = 2; v = throw "not evaluated"; } { k = 1; } ];
+in [ (map (x: x.v) values) strings (map (x: x.k) lazy) ]
@@ -0,0 +1,6 @@
+let
+  drv = name: { type = "derivation"; outPath = "/nix/store/${name}"; inherit name; };
+in
+builtins.unique [ 3 1 3 2 1 1.0 "a" "a" [ 1 ] [ 1 ] [ 2 ] { a = 1; } { a = 1; } null null true false true ]
+++ builtins.unique [ { a = 1; } { a = 2; } { b = 1; } { a = 1; } { a = 2; b = 1; } { a = 2; } ]
+++ map (d: d.name) (builtins.unique [ (drv "x") (drv "y") ((drv "x") // { extra = true; }) ])
@@ -0,0 +1,8 @@
+let
+  f = s: with s; x;
+  g = s: with { y = 1; }; with s; [ x y ];
+  s0 = { x = 7; };
+in
+  [ (f { x = 1; }) (f { x = 2; y = 3; }) (f { a = 0; x = 3; }) ]
+  ++ g { x = 4; } ++ g { x = 5; y = 6; }
+  ++ map (i: with s0; x + i) [ 0 1 ]
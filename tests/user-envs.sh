@@ -20,6 +20,39 @@ drvPath10=$(nix-env -f ./user-envs.nix -qa --drv-path --no-name '*' | grep foo-1
 
 # Query descriptions.
 nix-env -f ./user-envs.nix -qa '*' --description | grep -q silly
+
+# Querying with evaluation workers gives the same result.
+nix-env -f ./user-envs.nix -qa --json > $TEST_ROOT/query.json
+nix-env -f ./user-envs.nix -qa --json --option eval-workers 3 > $TEST_ROOT/query-parallel.json
+diff $TEST_ROOT/query.json $TEST_ROOT/query-parallel.json
+
+# Aliases of a derivation are listed once, even if different workers
+# find them, but distinct derivations with the same name are not
+# merged. Derivations whose store derivation can't be computed are
+# still listed.
+cat > $TEST_ROOT/aliases.nix <<EOF
+let
+  mk = name: {
+    type = "derivation";
+    inherit name;
+    system = "$system";
+    outPath = "/nonexistent/\${name}";
+    drvPath = "/nonexistent/\${name}.drv";
+    meta.description = "A test package";
+  };
+in rec {
+  aaa = mk "alias-1.0";
+  bbb = aaa;
+  ccc = aaa;
+  twin1 = mk "twin-1.0";
+  twin2 = mk "twin-1.0";
+  broken = mk "broken-1.0" // { drvPath = throw "no store derivation"; };
+}
+EOF
+nix-env -f $TEST_ROOT/aliases.nix -qa --json > $TEST_ROOT/query.json
+nix-env -f $TEST_ROOT/aliases.nix -qa --json --option eval-workers 3 > $TEST_ROOT/query-parallel.json
+diff $TEST_ROOT/query.json $TEST_ROOT/query-parallel.json
+[[ $(jq -c 'keys' $TEST_ROOT/query-parallel.json) = '["aaa","broken","twin1","twin2"]' ]]
 rm -rf $HOME/.nix-defexpr
 ln -s $(pwd)/user-envs.nix $HOME/.nix-defexpr
 nix-env -qa '*' --description | grep -q silly